@@ -0,0 +1,281 @@
+/* bench-hex.c --- Micro-benchmarks of the game engine */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Time the basic operations of hex_t on several board sizes and print
+   one line per benchmark and size, with tab-separated fields:
+
+     benchmark  size  ops  ns/op  ops/s
+
+   The benchmarks are:
+
+     move     Random games played with hex_move until the end of the
+              game. An operation is a move.
+     history  Sweeps of hex_history_jump from the end of a game to the
+              beginning and back. An operation is a move undone or
+              redone.
+     winner   The winning move of a game, undone and redone. This is
+              where the winner is detected. An operation is a pair.
+     sgf      hex_save_sgf and hex_load_sgf of a finished game. An
+              operation is a round trip. Only for sizes up to 26,
+              which are the ones SGF coordinates can express. */
+
+#include "config.h"
+#include "utils.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <glib.h>
+#include "conn-hex.h"
+
+/* Number of random games prepared for each size. */
+#define GAMES 64
+
+static gdouble min_seconds = 0.5;
+static gint only_size = 0;
+
+static GOptionEntry command_line_options[] =
+{
+  { "seconds", 't', 0, G_OPTION_ARG_DOUBLE, &min_seconds, "Minimum duration of each benchmark", "SECONDS" },
+  { "size", 's', 0, G_OPTION_ARG_INT, &only_size, "Run only the benchmarks of this size", "N" },
+  { NULL }
+};
+
+/* The sizes of the benchmarks. The games larger than HEX_SGF_MAX_SIZE
+   can be played but not saved, so their SGF benchmark is skipped. */
+static const int sizes[] = { 7, 11, 13, 19, 26, 32, 64, 128, 0 };
+
+/* A random game: the cells of the board in the order they are played,
+   which is a random permutation, and the number of moves until the
+   end of the game. */
+struct game_s
+{
+  guint32 * cells;
+  uint length;
+};
+
+static guint64 random_state = 88172645463325252ULL;
+
+static guint32
+random_below (guint32 n)
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state % n;
+}
+
+/* Store GAMES random games of size SIZE in GAMES. */
+static void
+games_init (struct game_s * games, size_t size)
+{
+  size_t cells = size*size;
+  hex_t hex = hex_new (size);
+  uint g, k;
+  for (g=0; g<GAMES; g++)
+    {
+      struct game_s * game = &games[g];
+      game->cells = g_new (guint32, cells);
+      for (k=0; k<cells; k++)
+        game->cells[k] = k;
+      for (k=cells-1; k>0; k--)
+        {
+          guint32 r = random_below (k+1);
+          guint32 tmp = game->cells[r];
+          game->cells[r] = game->cells[k];
+          game->cells[k] = tmp;
+        }
+      hex_reset (hex);
+      for (k=0; !hex_end_of_game_p (hex); k++)
+        hex_move (hex, game->cells[k] % size, game->cells[k] / size);
+      game->length = k;
+    }
+  hex_free (hex);
+}
+
+static void
+games_free (struct game_s * games)
+{
+  uint g;
+  for (g=0; g<GAMES; g++)
+    g_free (games[g].cells);
+}
+
+/* Play GAME in HEX from the empty board. */
+static void
+play_game (hex_t hex, struct game_s * game)
+{
+  size_t size = hex_size (hex);
+  uint k;
+  hex_reset (hex);
+  for (k=0; k<game->length; k++)
+    hex_move (hex, game->cells[k] % size, game->cells[k] / size);
+}
+
+static void
+report (const char * name, size_t size, guint64 ops, gint64 microseconds)
+{
+  double ns = microseconds * 1e3 / ops;
+  printf ("%s\t%u\t%" G_GUINT64_FORMAT "\t%.1f\t%.0f\n",
+          name, (uint)size, ops, ns, 1e9 / ns);
+  fflush (stdout);
+}
+
+/* Run the body of the loop until MIN_SECONDS have passed. */
+#define BENCHMARK_LOOP(start, elapsed)                                  \
+  for (start = g_get_monotonic_time (), elapsed = 0;                    \
+       elapsed < min_seconds * 1e6;                                     \
+       elapsed = g_get_monotonic_time () - start)
+
+static void
+bench_move (hex_t hex, struct game_s * games)
+{
+  guint64 ops = 0;
+  gint64 start, elapsed;
+  uint g = 0;
+  BENCHMARK_LOOP (start, elapsed)
+    {
+      play_game (hex, &games[g]);
+      ops += games[g].length;
+      g = (g + 1) % GAMES;
+    }
+  report ("move", hex_size (hex), ops, elapsed);
+}
+
+/* The history benchmarks need a game already played, which is not
+   part of the measure. Each game is replayed that many times. */
+#define REPETITIONS 256
+
+static void
+bench_history (hex_t hex, struct game_s * games)
+{
+  guint64 ops = 0;
+  gint64 total = 0;
+  gint64 start;
+  uint g = 0;
+  uint r;
+  while (total < min_seconds * 1e6)
+    {
+      uint length = games[g].length;
+      play_game (hex, &games[g]);
+      start = g_get_monotonic_time ();
+      for (r=0; r<REPETITIONS; r++)
+        {
+          hex_history_jump (hex, 0);
+          hex_history_jump (hex, length);
+        }
+      total += g_get_monotonic_time () - start;
+      ops += 2 * REPETITIONS * length;
+      g = (g + 1) % GAMES;
+    }
+  report ("history", hex_size (hex), ops, total);
+}
+
+static void
+bench_winner (hex_t hex, struct game_s * games)
+{
+  guint64 ops = 0;
+  gint64 total = 0;
+  gint64 start;
+  uint g = 0;
+  uint r;
+  while (total < min_seconds * 1e6)
+    {
+      uint length = games[g].length;
+      play_game (hex, &games[g]);
+      start = g_get_monotonic_time ();
+      for (r=0; r<REPETITIONS; r++)
+        {
+          hex_history_jump (hex, length - 1);
+          hex_history_jump (hex, length);
+        }
+      total += g_get_monotonic_time () - start;
+      ops += REPETITIONS;
+      g = (g + 1) % GAMES;
+    }
+  report ("winner", hex_size (hex), ops, total);
+}
+
+static void
+bench_sgf (hex_t hex, struct game_s * games, char * filename)
+{
+  guint64 ops = 0;
+  gint64 start, elapsed;
+  uint g = 0;
+  BENCHMARK_LOOP (start, elapsed)
+    {
+      hex_t loaded;
+      play_game (hex, &games[g]);
+      hex_save_sgf (hex, HEX_SGF, filename);
+      loaded = hex_load_sgf (HEX_SGF, filename);
+      if (loaded == NULL || hex_hash (loaded) != hex_hash (hex))
+        {
+          fprintf (stderr, "SGF round trip failed on size %u.\n", (uint)hex_size (hex));
+          exit (EXIT_FAILURE);
+        }
+      hex_free (loaded);
+      ops++;
+      g = (g + 1) % GAMES;
+    }
+  report ("sgf", hex_size (hex), ops, elapsed);
+}
+
+int
+main (int argc, char * argv[])
+{
+  GOptionContext * context;
+  GError * error = NULL;
+  struct game_s games[GAMES];
+  char * filename;
+  int fd;
+  int s;
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, command_line_options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("%s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+  fd = g_file_open_tmp ("bench-hex-XXXXXX.sgf", &filename, &error);
+  if (fd < 0)
+    {
+      g_print ("%s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+  close (fd);
+  printf ("benchmark\tsize\tops\tns/op\tops/s\n");
+  for (s=0; sizes[s]; s++)
+    {
+      hex_t hex;
+      if (only_size && sizes[s] != only_size)
+        continue;
+      hex = hex_new (sizes[s]);
+      games_init (games, sizes[s]);
+      bench_move (hex, games);
+      bench_history (hex, games);
+      bench_winner (hex, games);
+      if (sizes[s] <= HEX_SGF_MAX_SIZE)
+        bench_sgf (hex, games, filename);
+      games_free (games);
+      hex_free (hex);
+    }
+  unlink (filename);
+  g_free (filename);
+  return 0;
+}
+
+/* bench-hex.c ends here */
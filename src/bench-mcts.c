@@ -0,0 +1,131 @@
+/* bench-mcts.c --- Scaling benchmark of the Monte Carlo tree search */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Search the empty board during a fixed time with 1, 2, 4... threads
+   in each parallel mode, and print the playouts per second of each run
+   and its speedup with respect to one thread. */
+
+#include "config.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "conn-hex.h"
+#include "conn-mcts.h"
+
+static gint size = 11;
+static gdouble seconds = 5;
+static gint max_threads = 0;
+static gint max_nodes = 0;
+static gint leaf_batch = 0;
+static gchar * mode_name = NULL;
+
+static const struct {
+  const char * name;
+  mcts_mode_t mode;
+} modes[] = {
+  { "tree", MCTS_TREE_PARALLEL },
+  { "root", MCTS_ROOT_PARALLEL },
+  { "leaf", MCTS_LEAF_PARALLEL },
+  { NULL }
+};
+
+static GOptionEntry command_line_options[] =
+{
+  { "size", 's', 0, G_OPTION_ARG_INT, &size, "Size of the board", "N" },
+  { "seconds", 't', 0, G_OPTION_ARG_DOUBLE, &seconds, "Duration of each run", "SECONDS" },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &max_threads, "Maximum number of threads (default: all the processors)", "N" },
+  { "nodes", 'n', 0, G_OPTION_ARG_INT, &max_nodes, "Size of the node pool", "N" },
+  { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_name, "Parallel mode: tree, root or leaf (default: all)", "MODE" },
+  { "batch", 'b', 0, G_OPTION_ARG_INT, &leaf_batch, "Playouts per leaf in the leaf mode", "N" },
+  { NULL }
+};
+
+/* Run a search of the empty board in the mode number M with THREADS
+   threads and return the playouts per second. */
+static double
+run (hex_t hex, int m, uint threads)
+{
+  mcts_options_t options;
+  mcts_result_t result;
+  mcts_t mcts;
+  mcts_options_init (&options);
+  options.playouts = 0;
+  options.seconds = seconds;
+  options.threads = threads;
+  options.mode = modes[m].mode;
+  if (max_nodes > 0)
+    options.max_nodes = max_nodes;
+  if (leaf_batch > 0)
+    options.leaf_batch = leaf_batch;
+  mcts = mcts_new (hex, &options);
+  mcts_run (mcts);
+  mcts_get_result (mcts, &result);
+  mcts_free (mcts);
+  printf ("%s\t%u\t%lu\t%.0f", modes[m].name, threads, result.playouts, result.playouts / result.seconds);
+  return result.playouts / result.seconds;
+}
+
+int
+main (int argc, char * argv[])
+{
+  GOptionContext * context;
+  GError * error = NULL;
+  hex_t hex;
+  gint m;
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, command_line_options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("%s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+  if (max_threads <= 0)
+    max_threads = g_get_num_processors ();
+  hex = hex_new (size);
+  printf ("mode\tthreads\tplayouts\tplayouts/s\tspeedup\tefficiency\n");
+  for (m=0; modes[m].name; m++)
+    {
+      double base;
+      gint threads;
+      if (mode_name && strcmp (mode_name, modes[m].name) != 0)
+        continue;
+      base = run (hex, m, 1);
+      printf ("\t1.00\t1.00\n");
+      fflush (stdout);
+      for (threads=2; ; threads*=2)
+        {
+          double rate;
+          if (threads > max_threads)
+            {
+              /* Always measure the maximum. */
+              if (threads/2 == max_threads)
+                break;
+              threads = max_threads;
+            }
+          rate = run (hex, m, threads);
+          printf ("\t%.2f\t%.2f\n", rate / base, rate / base / threads);
+          fflush (stdout);
+        }
+    }
+  hex_free (hex);
+  return 0;
+}
+
+/* bench-mcts.c ends here */
@@ -0,0 +1,174 @@
+/* conn-analysis.c --- Background analysis of a position */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The analysis runs a Monte Carlo tree search on a snapshot of the
+   position, in slices of ANALYSIS_INTERVAL seconds. After each slice,
+   a report is built and handed to the main loop with an idle
+   function. Nothing of the search is shared with the main thread but
+   the analysis structure itself, which is reference counted: the
+   caller, the search thread and the pending report hold a reference
+   each. CANCELLED is only changed and checked for the callback in the
+   main thread, so no report is delivered after analysis_cancel. */
+
+#include "config.h"
+#include "utils.h"
+#include <math.h>
+#include <glib.h>
+#include "conn-hex.h"
+#include "conn-mcts.h"
+#include "conn-analysis.h"
+
+/* Duration of a slice of the search, in seconds. */
+#define ANALYSIS_INTERVAL 0.25
+
+/* The counters of the nodes of the search are 32 bits integers, so
+   the search is left when its playouts get close to the limit. */
+#define ANALYSIS_MAX_PLAYOUTS (G_MAXINT / 2)
+
+struct analysis_s
+{
+  volatile gint ref_count;
+  volatile gint cancelled;
+  /* Set while a report waits in the main loop. Further reports are
+     dropped meanwhile, so a busy main loop is not flooded. */
+  volatile gint report_pending;
+  mcts_t mcts;
+  size_t size;
+  analysis_callback_t callback;
+  gpointer user_data;
+};
+
+struct report_s
+{
+  analysis_t analysis;
+  analysis_report_t report;
+};
+
+static void
+analysis_unref (analysis_t analysis)
+{
+  if (g_atomic_int_dec_and_test (&analysis->ref_count))
+    {
+      mcts_free (analysis->mcts);
+      g_free (analysis);
+    }
+}
+
+static gboolean
+report_idle (gpointer data)
+{
+  struct report_s * r = data;
+  analysis_t analysis = r->analysis;
+  if (!analysis->cancelled)
+    analysis->callback (&r->report, analysis->user_data);
+  g_atomic_int_set (&analysis->report_pending, FALSE);
+  g_free (r->report.winrates);
+  g_free (r);
+  analysis_unref (analysis);
+  return FALSE;
+}
+
+/* Build a report of the search and queue it in the main loop. */
+static void
+post_report (analysis_t analysis)
+{
+  size_t cells = analysis->size * analysis->size;
+  unsigned long * visits;
+  unsigned long * wins;
+  mcts_result_t result;
+  struct report_s * r;
+  size_t k;
+  if (!g_atomic_int_compare_and_exchange (&analysis->report_pending, FALSE, TRUE))
+    return;
+  /* There is nothing to report until the search has a best move. */
+  if (!mcts_get_result (analysis->mcts, &result))
+    {
+      g_atomic_int_set (&analysis->report_pending, FALSE);
+      return;
+    }
+  r = g_new (struct report_s, 1);
+  r->analysis = analysis;
+  r->report.i = result.i;
+  r->report.j = result.j;
+  r->report.winrate = result.winrate;
+  r->report.playouts = result.playouts;
+  r->report.playouts_per_second = result.seconds > 0? result.playouts / result.seconds: 0;
+  r->report.pv_length = mcts_get_pv (analysis->mcts, r->report.pv, ANALYSIS_PV_MAX);
+  r->report.size = analysis->size;
+  r->report.winrates = g_new (float, cells);
+  visits = g_new (unsigned long, 2 * cells);
+  wins = visits + cells;
+  mcts_get_moves (analysis->mcts, visits, wins);
+  for (k=0; k<cells; k++)
+    r->report.winrates[k] = visits[k]? (float)wins[k] / visits[k]: NAN;
+  g_free (visits);
+  g_atomic_int_inc (&analysis->ref_count);
+  g_idle_add (report_idle, r);
+}
+
+static gpointer
+analysis_run (gpointer data)
+{
+  analysis_t analysis = data;
+  mcts_result_t result;
+  do
+    {
+      if (mcts_run (analysis->mcts) == 0)
+        break;
+      post_report (analysis);
+      mcts_get_result (analysis->mcts, &result);
+    }
+  while (result.playouts < ANALYSIS_MAX_PLAYOUTS);
+  analysis_unref (analysis);
+  return NULL;
+}
+
+analysis_t
+analysis_start (hex_t hex, analysis_callback_t callback, gpointer user_data)
+{
+  analysis_t analysis;
+  mcts_options_t options;
+  if (hex_end_of_game_p (hex))
+    return NULL;
+  mcts_options_init (&options);
+  options.playouts = 0;
+  options.seconds = ANALYSIS_INTERVAL;
+  /* Leave a processor for the interface. */
+  options.threads = MAX (1, g_get_num_processors () - 1);
+  analysis = g_new (struct analysis_s, 1);
+  analysis->ref_count = 2;
+  analysis->cancelled = FALSE;
+  analysis->report_pending = FALSE;
+  analysis->mcts = mcts_new (hex, &options);
+  analysis->size = hex_size (hex);
+  analysis->callback = callback;
+  analysis->user_data = user_data;
+  g_thread_unref (g_thread_new ("analysis", analysis_run, analysis));
+  return analysis;
+}
+
+void
+analysis_cancel (analysis_t analysis)
+{
+  analysis->cancelled = TRUE;
+  mcts_stop (analysis->mcts);
+  analysis_unref (analysis);
+}
+
+/* conn-analysis.c ends here */
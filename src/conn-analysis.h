@@ -0,0 +1,60 @@
+/* conn-analysis.h --- Background analysis of a position (Header) */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef CONN_ANALYSIS_H
+#define CONN_ANALYSIS_H
+
+#include <glib.h>
+#include "conn-hex.h"
+
+/* Maximum length of the principal variation of a report. */
+#define ANALYSIS_PV_MAX 16
+
+typedef struct analysis_s * analysis_t;
+
+typedef struct {
+  uint i, j;                    /* Best move */
+  double winrate;               /* Win rate of the best move */
+  unsigned long playouts;       /* Playouts done so far */
+  double playouts_per_second;
+  /* Principal variation, as indexes of cells (j*size + i). */
+  size_t pv_length;
+  uint pv[ANALYSIS_PV_MAX];
+  /* Win rate of the player to move for each cell, in the order
+     (0,0), (1,0)... (size-1,size-1), or NaN if it is not known. */
+  size_t size;
+  float * winrates;
+} analysis_report_t;
+
+typedef void (*analysis_callback_t) (const analysis_report_t * report, gpointer user_data);
+
+/* Start the analysis of the current position of HEX in other threads,
+   which goes on until it is cancelled. CALLBACK is called from the
+   main loop with a report several times per second. Return NULL if
+   the game is over. */
+analysis_t analysis_start (hex_t hex, analysis_callback_t callback, gpointer user_data);
+
+/* Stop ANALYSIS and free it. CALLBACK is not called anymore
+   afterwards, and this returns at once, while the threads finish in
+   the background. */
+void analysis_cancel (analysis_t analysis);
+
+#endif  /* CONN_ANALYSIS_H */
+
+/* conn-analysis.h ends here */
@@ -0,0 +1,205 @@
+/* conn-bitboard.c --- Word-parallel sets of cells */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "conn-bitboard.h"
+
+/* The neighbors of the cell (i,j) are (i±1,j), (i,j±1), (i+1,j+1)
+   and (i-1,j-1). In terms of bit numbers, they are k±1, k±size and
+   k±(size+1). So the neighbors of a whole set of cells are computed
+   by shifting the bitboard, but shifts by 1 and size+1 wrap around
+   the rows, and the bits which land in the first column (resp. last
+   column) must be discarded. */
+
+struct bitboard_layout_s
+{
+  size_t size;
+  size_t words;
+  guint64 * board;              /* All the cells */
+  guint64 * edge[4];            /* Indexed by bitboard_edge_t */
+};
+
+bitboard_layout_t
+bitboard_layout_new (size_t size)
+{
+  bitboard_layout_t layout;
+  size_t words = (size*size + 63) / 64;
+  size_t i, j;
+  int t;
+  layout = g_malloc (sizeof(struct bitboard_layout_s));
+  layout->size = size;
+  layout->words = words;
+  layout->board = g_malloc0 (5 * words * sizeof(guint64));
+  for (t=0; t<4; t++)
+    layout->edge[t] = layout->board + (t+1) * words;
+  for (j=0; j<size; j++)
+    {
+      for (i=0; i<size; i++)
+        {
+          size_t k = j*size + i;
+          BITBOARD_SET (layout->board, k);
+          if (j == 0)
+            BITBOARD_SET (layout->edge[BITBOARD_FIRST_ROW], k);
+          if (j == size-1)
+            BITBOARD_SET (layout->edge[BITBOARD_LAST_ROW], k);
+          if (i == 0)
+            BITBOARD_SET (layout->edge[BITBOARD_FIRST_COLUMN], k);
+          if (i == size-1)
+            BITBOARD_SET (layout->edge[BITBOARD_LAST_COLUMN], k);
+        }
+    }
+  return layout;
+}
+
+void
+bitboard_layout_free (bitboard_layout_t layout)
+{
+  g_free (layout->board);
+  g_free (layout);
+}
+
+size_t
+bitboard_layout_words (bitboard_layout_t layout)
+{
+  return layout->words;
+}
+
+const guint64 *
+bitboard_layout_board (bitboard_layout_t layout)
+{
+  return layout->board;
+}
+
+const guint64 *
+bitboard_layout_edge (bitboard_layout_t layout, bitboard_edge_t edge)
+{
+  return layout->edge[edge];
+}
+
+
+/* Bitboards */
+
+void
+bitboard_copy (bitboard_layout_t layout, bitboard_t dst, const guint64 * src)
+{
+  memcpy (dst, src, layout->words * sizeof(guint64));
+}
+
+void
+bitboard_and (bitboard_layout_t layout, bitboard_t dst, const guint64 * src)
+{
+  size_t w;
+  for (w=0; w<layout->words; w++)
+    dst[w] &= src[w];
+}
+
+boolean
+bitboard_intersect_p (bitboard_layout_t layout, const guint64 * a, const guint64 * b)
+{
+  size_t w;
+  for (w=0; w<layout->words; w++)
+    if (a[w] & b[w])
+      return TRUE;
+  return FALSE;
+}
+
+
+/* Connectivity */
+
+/* Return the word W of the bitboard B shifted S bits towards the
+   higher bit numbers. */
+static inline guint64
+shift_up (const guint64 * b, size_t w, size_t s)
+{
+  size_t q = s / 64;
+  size_t r = s % 64;
+  guint64 x;
+  if (w < q)
+    return 0;
+  x = b[w-q] << r;
+  if (r != 0 && w > q)
+    x |= b[w-q-1] >> (64 - r);
+  return x;
+}
+
+/* Return the word W of the bitboard B shifted S bits towards the
+   lower bit numbers. B has WORDS words. */
+static inline guint64
+shift_down (const guint64 * b, size_t words, size_t w, size_t s)
+{
+  size_t q = s / 64;
+  size_t r = s % 64;
+  guint64 x;
+  if (w + q >= words)
+    return 0;
+  x = b[w+q] >> r;
+  if (r != 0 && w+q+1 < words)
+    x |= b[w+q+1] << (64 - r);
+  return x;
+}
+
+/* Return the word W of the set of neighbors of the cells in B. */
+static inline guint64
+neighbors_word (bitboard_layout_t layout, const guint64 * b, size_t w)
+{
+  size_t size = layout->size;
+  size_t words = layout->words;
+  guint64 forward, backward, vertical;
+  forward = shift_up (b, w, 1) | shift_up (b, w, size+1);
+  backward = shift_down (b, words, w, 1) | shift_down (b, words, w, size+1);
+  vertical = shift_up (b, w, size) | shift_down (b, words, w, size);
+  return ((forward & ~layout->edge[BITBOARD_FIRST_COLUMN][w])
+          | (backward & ~layout->edge[BITBOARD_LAST_COLUMN][w])
+          | vertical) & layout->board[w];
+}
+
+/* Grow SET with the cells of MASK which are connected to SET through
+   cells of MASK. The set is updated in place: the bits added to SET
+   are always reachable, so reading the partially updated words in the
+   same pass only makes the fill converge sooner. Return TRUE if SET
+   was changed. */
+boolean
+bitboard_flood (bitboard_layout_t layout, bitboard_t set, const guint64 * mask)
+{
+  size_t words = layout->words;
+  boolean changed = FALSE;
+  boolean pass_changed;
+  size_t w;
+  do
+    {
+      pass_changed = FALSE;
+      for (w=0; w<words; w++)
+        {
+          guint64 x = set[w] | (neighbors_word (layout, set, w) & mask[w]);
+          if (x != set[w])
+            {
+              set[w] = x;
+              pass_changed = TRUE;
+            }
+        }
+      changed |= pass_changed;
+    }
+  while (pass_changed);
+  return changed;
+}
+
+/* conn-bitboard.c ends here */
@@ -0,0 +1,66 @@
+/* conn-bitboard.h --- Word-parallel sets of cells (Header) */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef CONN_BITBOARD_H
+#define CONN_BITBOARD_H
+
+#include "conn-types.h"
+#include <stdlib.h>
+#include <glib.h>
+
+/* A bitboard is a set of cells of a board, packed into 64-bit
+   words. The cell (i,j) is the bit number j*size + i. Bits beyond the
+   last cell are always zero. The number of words and the masks of the
+   edges depend on the size of the board, so they are kept apart in a
+   bitboard layout, which can be shared by any number of bitboards. */
+typedef guint64 * bitboard_t;
+typedef struct bitboard_layout_s * bitboard_layout_t;
+
+typedef enum {
+  BITBOARD_FIRST_ROW,           /* j = 0 */
+  BITBOARD_LAST_ROW,            /* j = size-1 */
+  BITBOARD_FIRST_COLUMN,        /* i = 0 */
+  BITBOARD_LAST_COLUMN          /* i = size-1 */
+} bitboard_edge_t;
+
+#define BITBOARD_WORD(k) ((k) >> 6)
+#define BITBOARD_BIT(k)  (G_GUINT64_CONSTANT(1) << ((k) & 63))
+
+#define BITBOARD_TEST(b,k)  (((b)[BITBOARD_WORD(k)] & BITBOARD_BIT(k)) != 0)
+#define BITBOARD_SET(b,k)   ((b)[BITBOARD_WORD(k)] |= BITBOARD_BIT(k))
+#define BITBOARD_RESET(b,k) ((b)[BITBOARD_WORD(k)] &= ~BITBOARD_BIT(k))
+
+/* Layouts */
+bitboard_layout_t bitboard_layout_new (size_t size);
+void bitboard_layout_free (bitboard_layout_t layout);
+size_t bitboard_layout_words (bitboard_layout_t layout);
+const guint64 * bitboard_layout_board (bitboard_layout_t layout);
+const guint64 * bitboard_layout_edge (bitboard_layout_t layout, bitboard_edge_t edge);
+
+/* Bitboards */
+void bitboard_copy (bitboard_layout_t layout, bitboard_t dst, const guint64 * src);
+void bitboard_and (bitboard_layout_t layout, bitboard_t dst, const guint64 * src);
+boolean bitboard_intersect_p (bitboard_layout_t layout, const guint64 * a, const guint64 * b);
+
+/* Connectivity */
+boolean bitboard_flood (bitboard_layout_t layout, bitboard_t set, const guint64 * mask);
+
+#endif  /* CONN_BITBOARD_H */
+
+/* conn-bitboard.h ends here */
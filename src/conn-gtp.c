@@ -0,0 +1,472 @@
+/* conn-gtp.c --- Go Text Protocol front-end of the engine */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The program reads GTP commands from the standard input and writes
+   the responses to the standard output, so that it can be driven by
+   controllers such as HexGui or gogui-twogtp. Black is the first
+   player, who connects the first and the last rows. A cell is named
+   by the letter of its column and the number of its row, so a1 is the
+   corner (0,0).
+
+   Commands are parsed in place in a fixed buffer, and responses are
+   formatted in another one, so the protocol itself does not allocate
+   memory. Only boardsize and genmove do, to create the new board and
+   the search tree respectively. */
+
+#include "config.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <glib.h>
+#include "conn-hex.h"
+#include "conn-mcts.h"
+
+#define GTP_LINE_MAX 1024
+#define GTP_RESPONSE_MAX 8192
+#define GTP_ARGS_MAX 8
+
+/* Coordinates are a single letter. */
+#define GTP_MAX_SIZE 26
+
+static gint initial_size = 11;
+static gint playouts = 0;
+static gdouble seconds = 0;
+static gint threads = 1;
+
+static GOptionEntry command_line_options[] =
+{
+  { "size", 's', 0, G_OPTION_ARG_INT, &initial_size, "Initial size of the board", "N" },
+  { "playouts", 'p', 0, G_OPTION_ARG_INT, &playouts, "Playouts of each search", "N" },
+  { "seconds", 't', 0, G_OPTION_ARG_DOUBLE, &seconds, "Duration of each search", "SECONDS" },
+  { "threads", 'j', 0, G_OPTION_ARG_INT, &threads, "Threads of each search", "N" },
+  { NULL }
+};
+
+static hex_t hex;
+static mcts_options_t search_options;
+static boolean quit_p;
+
+/* A command handler gets the arguments of the command and formats the
+   response in OUT, which has room for SIZE characters. It returns TRUE
+   on success and FALSE if the response is an error message. */
+typedef boolean (*gtp_handler_t) (int argc, char * argv[], char * out, size_t size);
+
+struct gtp_command_s
+{
+  const char * name;
+  gtp_handler_t handler;
+};
+
+
+/* Parsing */
+
+/* Return the player of the color named NAME, or 0 if it is not a
+   color. */
+static int
+parse_color (const char * name)
+{
+  if (g_ascii_strcasecmp (name, "b") == 0 || g_ascii_strcasecmp (name, "black") == 0)
+    return 1;
+  else if (g_ascii_strcasecmp (name, "w") == 0 || g_ascii_strcasecmp (name, "white") == 0)
+    return 2;
+  else
+    return 0;
+}
+
+/* Store in I and J the cell named NAME. Return FALSE if NAME is not a
+   cell of the current board. */
+static boolean
+parse_vertex (const char * name, uint * i, uint * j)
+{
+  char * end;
+  long row;
+  if (!g_ascii_isalpha (name[0]) || !g_ascii_isdigit (name[1]))
+    return FALSE;
+  row = strtol (name+1, &end, 10);
+  if (*end != '\0')
+    return FALSE;
+  *i = g_ascii_tolower (name[0]) - 'a';
+  *j = row - 1;
+  return *i < hex_size (hex) && row >= 1 && *j < hex_size (hex);
+}
+
+/* Split LINE in place into at most GTP_ARGS_MAX words and store them
+   in ARGV. Control characters are discarded and comments are removed,
+   as the protocol requires. Return the number of words. */
+static int
+split_line (char * line, char * argv[])
+{
+  int argc = 0;
+  char * src;
+  char * dst;
+  char * p;
+  for (src=dst=line; *src && *src != '#'; src++)
+    {
+      if (*src == '\t')
+        *dst++ = ' ';
+      else if (!iscntrl ((unsigned char)*src))
+        *dst++ = *src;
+    }
+  *dst = '\0';
+  for (p=strtok (line, " "); p && argc < GTP_ARGS_MAX; p=strtok (NULL, " "))
+    argv[argc++] = p;
+  return argc;
+}
+
+
+/* Commands */
+
+static boolean
+cmd_protocol_version (int argc, char * argv[], char * out, size_t size)
+{
+  g_strlcpy (out, "2", size);
+  return TRUE;
+}
+
+static boolean
+cmd_name (int argc, char * argv[], char * out, size_t size)
+{
+  g_strlcpy (out, PACKAGE_NAME, size);
+  return TRUE;
+}
+
+static boolean
+cmd_version (int argc, char * argv[], char * out, size_t size)
+{
+  g_strlcpy (out, PACKAGE_VERSION, size);
+  return TRUE;
+}
+
+static boolean
+cmd_quit (int argc, char * argv[], char * out, size_t size)
+{
+  quit_p = TRUE;
+  out[0] = '\0';
+  return TRUE;
+}
+
+static boolean
+cmd_boardsize (int argc, char * argv[], char * out, size_t size)
+{
+  char * end;
+  long n;
+  if (argc < 1)
+    {
+      g_strlcpy (out, "syntax error", size);
+      return FALSE;
+    }
+  n = strtol (argv[0], &end, 10);
+  if (*end != '\0' || n < 1 || n > GTP_MAX_SIZE)
+    {
+      g_strlcpy (out, "unacceptable size", size);
+      return FALSE;
+    }
+  if ((size_t)n != hex_size (hex))
+    {
+      hex_free (hex);
+      hex = hex_new (n);
+    }
+  else
+    {
+      hex_reset (hex);
+    }
+  out[0] = '\0';
+  return TRUE;
+}
+
+static boolean
+cmd_clear_board (int argc, char * argv[], char * out, size_t size)
+{
+  hex_reset (hex);
+  out[0] = '\0';
+  return TRUE;
+}
+
+static boolean
+cmd_play (int argc, char * argv[], char * out, size_t size)
+{
+  int player;
+  uint i, j;
+  if (argc < 2 || (player = parse_color (argv[0])) == 0)
+    {
+      g_strlcpy (out, "syntax error", size);
+      return FALSE;
+    }
+  if (g_ascii_strcasecmp (argv[1], "resign") == 0)
+    {
+      out[0] = '\0';
+      return TRUE;
+    }
+  if (!parse_vertex (argv[1], &i, &j))
+    {
+      g_strlcpy (out, "illegal move", size);
+      return FALSE;
+    }
+  if (player != hex_get_player (hex))
+    {
+      g_strlcpy (out, "wrong color to move", size);
+      return FALSE;
+    }
+  switch (hex_move (hex, i, j))
+    {
+    case HEX_SUCCESS:
+      out[0] = '\0';
+      return TRUE;
+    case HEX_BUSY_CELL:
+      g_strlcpy (out, "cell occupied", size);
+      return FALSE;
+    case HEX_END_OF_GAME:
+      g_strlcpy (out, "game is over", size);
+      return FALSE;
+    default:
+      g_strlcpy (out, "illegal move", size);
+      return FALSE;
+    }
+}
+
+static boolean
+cmd_genmove (int argc, char * argv[], char * out, size_t size)
+{
+  int player;
+  uint i, j;
+  if (argc < 1 || (player = parse_color (argv[0])) == 0)
+    {
+      g_strlcpy (out, "syntax error", size);
+      return FALSE;
+    }
+  if (player != hex_get_player (hex))
+    {
+      g_strlcpy (out, "wrong color to move", size);
+      return FALSE;
+    }
+  if (!mcts_genmove (hex, &search_options, &i, &j))
+    {
+      g_strlcpy (out, "resign", size);
+      return TRUE;
+    }
+  hex_move (hex, i, j);
+  g_snprintf (out, size, "%c%u", 'a' + i, j + 1);
+  return TRUE;
+}
+
+static boolean
+cmd_undo (int argc, char * argv[], char * out, size_t size)
+{
+  unsigned int current = hex_history_current (hex);
+  if (current == 0)
+    {
+      g_strlcpy (out, "cannot undo", size);
+      return FALSE;
+    }
+  hex_history_jump (hex, current - 1);
+  hex_truncate_history (hex);
+  out[0] = '\0';
+  return TRUE;
+}
+
+static boolean
+cmd_showboard (int argc, char * argv[], char * out, size_t size)
+{
+  uint n = hex_size (hex);
+  size_t length = 0;
+  uint i, j;
+  /* The board is drawn as a rhombus, shifting every row to the right
+     by one more column. Each line needs 3 characters per cell at
+     most, so it is always below GTP_RESPONSE_MAX. */
+#define PUT(...) \
+  (length += g_snprintf (out + length, length < size ? size - length : 0, __VA_ARGS__))
+  PUT ("\n   ");
+  for (i=0; i<n; i++)
+    PUT (" %c", 'a' + i);
+  for (j=0; j<n; j++)
+    {
+      PUT ("\n%*s%2u ", (int)j, "", j + 1);
+      for (i=0; i<n; i++)
+        {
+          switch (hex_cell_player (hex, i, j))
+            {
+            case 1:  PUT (" X"); break;
+            case 2:  PUT (" O"); break;
+            default: PUT (" ."); break;
+            }
+        }
+      PUT (" %u", j + 1);
+    }
+  PUT ("\n%*s", (int)n + 2, "");
+  for (i=0; i<n; i++)
+    PUT (" %c", 'a' + i);
+#undef PUT
+  return TRUE;
+}
+
+static boolean
+cmd_final_score (int argc, char * argv[], char * out, size_t size)
+{
+  if (!hex_end_of_game_p (hex))
+    {
+      g_strlcpy (out, "game is not over", size);
+      return FALSE;
+    }
+  /* The turn has passed to the loser. */
+  g_strlcpy (out, hex_get_player (hex) == 1 ? "W+" : "B+", size);
+  return TRUE;
+}
+
+static boolean cmd_known_command (int argc, char * argv[], char * out, size_t size);
+static boolean cmd_list_commands (int argc, char * argv[], char * out, size_t size);
+
+static const struct gtp_command_s commands[] =
+{
+  { "boardsize",        cmd_boardsize },
+  { "clear_board",      cmd_clear_board },
+  { "final_score",      cmd_final_score },
+  { "genmove",          cmd_genmove },
+  { "known_command",    cmd_known_command },
+  { "list_commands",    cmd_list_commands },
+  { "name",             cmd_name },
+  { "play",             cmd_play },
+  { "protocol_version", cmd_protocol_version },
+  { "quit",             cmd_quit },
+  { "showboard",        cmd_showboard },
+  { "undo",             cmd_undo },
+  { "version",          cmd_version },
+  { NULL }
+};
+
+static boolean
+cmd_known_command (int argc, char * argv[], char * out, size_t size)
+{
+  const struct gtp_command_s * command;
+  if (argc < 1)
+    {
+      g_strlcpy (out, "syntax error", size);
+      return FALSE;
+    }
+  for (command=commands; command->name; command++)
+    {
+      if (strcmp (command->name, argv[0]) == 0)
+        {
+          g_strlcpy (out, "true", size);
+          return TRUE;
+        }
+    }
+  g_strlcpy (out, "false", size);
+  return TRUE;
+}
+
+static boolean
+cmd_list_commands (int argc, char * argv[], char * out, size_t size)
+{
+  const struct gtp_command_s * command;
+  out[0] = '\0';
+  for (command=commands; command->name; command++)
+    {
+      if (command != commands)
+        g_strlcat (out, "\n", size);
+      g_strlcat (out, command->name, size);
+    }
+  return TRUE;
+}
+
+
+/* Main loop */
+
+/* Run the command in LINE and write its response. */
+static void
+run_command (char * line)
+{
+  static char response[GTP_RESPONSE_MAX];
+  const struct gtp_command_s * command;
+  char * argv[GTP_ARGS_MAX];
+  const char * id = "";
+  boolean success = FALSE;
+  int argc;
+  argc = split_line (line, argv);
+  if (argc == 0)
+    return;
+  if (g_ascii_isdigit (argv[0][0]))
+    {
+      id = argv[0];
+      argc--;
+      memmove (argv, argv+1, argc * sizeof(char*));
+    }
+  g_strlcpy (response, "unknown command", sizeof(response));
+  if (argc > 0)
+    {
+      for (command=commands; command->name; command++)
+        {
+          if (strcmp (command->name, argv[0]) == 0)
+            {
+              success = command->handler (argc-1, argv+1, response, sizeof(response));
+              break;
+            }
+        }
+    }
+  printf ("%c%s%s%s\n\n", success ? '=' : '?', id, response[0] ? " " : "", response);
+  fflush (stdout);
+}
+
+int
+main (int argc, char * argv[])
+{
+  static char line[GTP_LINE_MAX];
+  GOptionContext * context;
+  GError * error = NULL;
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, command_line_options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("%s\n", error->message);
+      exit (EXIT_FAILURE);
+    }
+  if (initial_size < 1 || initial_size > GTP_MAX_SIZE)
+    {
+      g_print ("The size of the board must be between 1 and %d.\n", GTP_MAX_SIZE);
+      exit (EXIT_FAILURE);
+    }
+  mcts_options_init (&search_options);
+  if (playouts > 0 || seconds > 0)
+    {
+      search_options.playouts = playouts;
+      search_options.seconds = seconds;
+    }
+  search_options.threads = threads;
+  hex = hex_new (initial_size);
+  quit_p = FALSE;
+  while (!quit_p && fgets (line, sizeof(line), stdin))
+    {
+      size_t length = strlen (line);
+      if (length > 0 && line[length-1] != '\n' && !feof (stdin))
+        {
+          /* Skip the rest of a line which does not fit in the buffer. */
+          int c;
+          while ((c = getchar ()) != EOF && c != '\n')
+            ;
+          printf ("? line too long\n\n");
+          fflush (stdout);
+          continue;
+        }
+      run_command (line);
+    }
+  hex_free (hex);
+  return 0;
+}
+
+/* conn-gtp.c ends here */
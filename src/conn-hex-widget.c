@@ -27,8 +27,6 @@
 #include "conn-hex-widget.h"
 #include "conn-marshallers.h"
 
-#define BOARD_MAX_SIZE 32
-
 /* The following figure is included as illustration of the Hex board in
    order to you can read easily the geometry-related source code above.
 
@@ -51,8 +49,16 @@
 
 #define HEXBOARD_BORDER_WIDTH 10
 
+/* Minimum interval between two redraws of the overlay, in ms. */
+#define OVERLAY_INTERVAL 50
+
+/* Number of distinct levels of the overlay. Changes of a value within
+   the same level, which would not be visible, do not redraw the
+   cell. */
+#define OVERLAY_LEVELS 100
+
 static void hexboard_init(Hexboard *hexboard);
-static void hexboard_finalize(Hexboard *hexboard);
+static void hexboard_finalize(GObject *object);
 static void hexboard_class_init(HexboardClass *klass);
 static gboolean hexboard_configure (GtkWidget * widget, GdkEventConfigure *event);
 static gboolean hexboard_expose(GtkWidget * widget, GdkEventExpose *event);
@@ -64,13 +70,13 @@ static void cell_to_pixel (Hexboard * hexboard, int i, int j,
 static void pixel_to_cell (Hexboard * hexboard, int x, int y,
                            int *output_i, int *output_j);
 
-static void draw_board (Hexboard * hexboard, cairo_t * cr,
-                        gint width, gint height);
+static void draw_board (Hexboard * hexboard, cairo_t * cr);
+static void update_background (Hexboard * hexboard, cairo_surface_t * target);
 
 
 G_DEFINE_TYPE (Hexboard, hexboard, GTK_TYPE_DRAWING_AREA);
 
-typedef struct _HexboardPrivate {
+struct _HexboardPrivate {
   uint size;
   int border;
   /* Geometry of the board in the viewport widget. They are computed
@@ -82,15 +88,53 @@ typedef struct _HexboardPrivate {
   float board_height;
   float cell_width;
   float cell_height;
-  struct {
-    double r, g, b;             /* Color */
-    double border;              /* Border witdh */
-  } cells[BOARD_MAX_SIZE][BOARD_MAX_SIZE];
+  /* Attributes of the cells, as arrays of SIZE*SIZE elements indexed
+     by CELL_INDEX. They are allocated in a single block by
+     hexboard_set_size. */
+  float * cell_color[3];        /* Red, green and blue */
+  float * cell_border;          /* Border width */
   double border_color[4][3];
-} HexboardPrivate;
+  /* Cached geometry of the cells, computed by update_geometry. The
+     hexagon of the cell (i,j) is built from the centers of the cells
+     (i,j), (i+1,j), (i+1,j+1) and (i,j+1), so the centers are kept
+     for a lattice of (SIZE+1)x(SIZE+1) points, indexed by
+     LATTICE_INDEX. VERTEX_DX and VERTEX_DY are the offsets of the
+     bottom vertices of a hexagon from its center. GRID_PATH is the
+     outline of every cell, to be stroked in a single call. */
+  guint lattice_size;
+  int * lattice_x;
+  int * lattice_y;
+  double vertex_dx;
+  double vertex_dy;
+  cairo_path_t * grid_path;
+  /* The borders, empty cells and grid rendered by update_background,
+     or NULL if they must be rendered again. */
+  cairo_surface_t * background;
+  /* Cells whose area has been invalidated and not exposed yet, so
+     further changes before the next expose event do not need to
+     invalidate them again. */
+  guint8 * cell_dirty;
+  /* Overlay values shown in the board and the last ones set, as two
+     arrays of SIZE*SIZE elements in a single block, or NULL if there
+     is no overlay. OVERLAY_SOURCE is the timeout which will show the
+     last values, if any. */
+  float * overlay;
+  float * overlay_next;
+  gboolean overlay_labels;
+  guint overlay_source;
+  /* Nesting level of hexboard_begin_update, and the area invalidated
+     by the changes since the outermost one, if PENDING is set. */
+  guint update_depth;
+  gboolean pending;
+  GdkRectangle pending_area;
+};
 
-#define HEXBOARD_GET_PRIVATE(obj)                                       \
-  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), TYPE_HEXBOARD, HexboardPrivate))
+/* The private structure is looked up once in hexboard_init, as the
+   cell accessors are called for every cell of the board. */
+#define HEXBOARD_GET_PRIVATE(obj) (((Hexboard *)(obj))->priv)
+
+#define CELL_INDEX(st,i,j) ((j)*(st)->size + (i))
+#define LATTICE_INDEX(st,i,j) ((j)*((st)->lattice_size + 1) + (i))
 
 
 /* Transform the cell coordinates (I,J) to pixel-based coordinates of
@@ -166,9 +210,22 @@ pixel_to_cell (Hexboard * hexboard, int x, int y, int *output_i, int *output_j)
 static void
 hexboard_init(Hexboard * hexboard)
 {
-  HexboardPrivate * state = HEXBOARD_GET_PRIVATE (hexboard);
-  int i,j;
-  guint size = BOARD_MAX_SIZE;
+  HexboardPrivate * state;
+  hexboard->priv = G_TYPE_INSTANCE_GET_PRIVATE (hexboard, TYPE_HEXBOARD, HexboardPrivate);
+  state = HEXBOARD_GET_PRIVATE (hexboard);
+  state->size = 0;
+  state->cell_color[0] = state->cell_color[1] = state->cell_color[2] = NULL;
+  state->cell_border = NULL;
+  state->lattice_size = 0;
+  state->lattice_x = state->lattice_y = NULL;
+  state->grid_path = NULL;
+  state->background = NULL;
+  state->cell_dirty = NULL;
+  state->overlay = state->overlay_next = NULL;
+  state->overlay_labels = FALSE;
+  state->overlay_source = 0;
+  state->update_depth = 0;
+  state->pending = FALSE;
   state->border = 30;
   /* Default border colors are green and red. */
   state->border_color[HEXBOARD_BORDER_SW][0] =
@@ -183,26 +240,36 @@ hexboard_init(Hexboard * hexboard)
     state->border_color[HEXBOARD_BORDER_NW][1] = 1;
   state->border_color[HEXBOARD_BORDER_SE][2] =
     state->border_color[HEXBOARD_BORDER_NW][2] = 0;
-  for (i=0; i<size; i++)
-    {
-      for (j=0; j<size; j++)
-        {
-          state->cells[i][j].r = 1;
-          state->cells[i][j].g = 1;
-          state->cells[i][j].b = 1;
-          state->cells[i][j].border = 1;
-        }
-    }
   gtk_widget_add_events (GTK_WIDGET (hexboard), GDK_BUTTON_PRESS_MASK);
 }
 
+static void
+hexboard_finalize (GObject * object)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (object);
+  g_free (st->cell_color[0]);
+  g_free (st->lattice_x);
+  g_free (st->cell_dirty);
+  g_free (st->overlay);
+  if (st->overlay_source)
+    g_source_remove (st->overlay_source);
+  if (st->grid_path)
+    cairo_path_destroy (st->grid_path);
+  if (st->background)
+    cairo_surface_destroy (st->background);
+  G_OBJECT_CLASS (hexboard_parent_class)->finalize (object);
+}
+
 static void
 hexboard_class_init(HexboardClass * klass)
 {
+  GObjectClass *gobject_class;
   GtkWidgetClass *widget_class;
   GtkObjectClass *object_class;
+  gobject_class = (GObjectClass *) klass;
   widget_class = (GtkWidgetClass *) klass;
   object_class = (GtkObjectClass *) klass;
+  gobject_class->finalize = hexboard_finalize;
   widget_class->expose_event = hexboard_expose;
   widget_class->configure_event = hexboard_configure;
   widget_class->button_press_event = hexboard_button_press;
@@ -217,13 +284,20 @@ hexboard_class_init(HexboardClass * klass)
 }
 
 
-static gboolean
-hexboard_configure (GtkWidget * widget, GdkEventConfigure *event)
+static void draw_cell_path (HexboardPrivate * st, cairo_t * cr, gint i, gint j);
+
+/* Compute the geometry of the board for the current allocation of
+   the widget and the current size, and cache the coordinates of the
+   cells and the path of the grid. */
+static void
+update_geometry (Hexboard * hexboard)
 {
-  Hexboard * hexboard = HEXBOARD (widget);
+  GtkWidget * widget = GTK_WIDGET (hexboard);
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
-  int border = st->border;
   int n = st->size;
+  cairo_surface_t * surface;
+  cairo_t * cr;
+  int i, j;
   GtkAllocation rect;
   float height;
   float width;
@@ -247,6 +321,49 @@ hexboard_configure (GtkWidget * widget, GdkEventConfigure *event)
   st->board_top = st->border + (rect.height - st->board_height) / 2;
   st->cell_width = 2 * radious;
   st->cell_height = 2 * apothem;
+  st->vertex_dx = radious/2;
+  st->vertex_dy = sqrt(3)/2 * radious;
+  /* Lattice */
+  if (st->lattice_size != n)
+    {
+      g_free (st->lattice_x);
+      st->lattice_x = g_new (int, 2 * (n+1)*(n+1));
+      st->lattice_y = st->lattice_x + (n+1)*(n+1);
+      st->lattice_size = n;
+    }
+  for (j=0; j<=n; j++)
+    for (i=0; i<=n; i++)
+      cell_to_pixel (hexboard, i, j,
+                     &st->lattice_x[LATTICE_INDEX (st, i, j)],
+                     &st->lattice_y[LATTICE_INDEX (st, i, j)]);
+  /* Grid. A path can only be built in a cairo context, so a dummy one
+     is used. */
+  if (st->grid_path)
+    cairo_path_destroy (st->grid_path);
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 1, 1);
+  cr = cairo_create (surface);
+  for (j=0; j<n; j++)
+    for (i=0; i<n; i++)
+      draw_cell_path (st, cr, i, j);
+  st->grid_path = cairo_copy_path (cr);
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+  /* The background depends on all of the above. */
+  if (st->background)
+    {
+      cairo_surface_destroy (st->background);
+      st->background = NULL;
+    }
+}
+
+static gboolean
+hexboard_configure (GtkWidget * widget, GdkEventConfigure *event)
+{
+  cairo_t * cr;
+  update_geometry (HEXBOARD (widget));
+  cr = gdk_cairo_create (widget->window);
+  update_background (HEXBOARD (widget), cairo_get_target (cr));
+  cairo_destroy (cr);
   return TRUE;
 }
 
@@ -371,39 +488,92 @@ draw_border_ne (Hexboard * hexboard, cairo_t * cr, double r, double g, double b)
   cairo_fill (cr);
 }
 
+/* Store in RECT the bounding rectangle of the hexagon of the cell
+   (I,J), including its edge when it is stroked with width BORDER. */
+static void
+cell_extents (HexboardPrivate * st, gint i, gint j, double border, GdkRectangle * rect)
+{
+  const int * x = st->lattice_x;
+  const int * y = st->lattice_y;
+  int pad = ceil (border/2) + 1;
+  int k0 = LATTICE_INDEX (st, i+0, j+0);
+  int k1 = LATTICE_INDEX (st, i+1, j+0);
+  int k2 = LATTICE_INDEX (st, i+1, j+1);
+  int k3 = LATTICE_INDEX (st, i+0, j+1);
+  /* See draw_cell_path for the vertices of the hexagon. The leftmost
+     and rightmost ones come from the cells (i,j+1) and (i+1,j), and
+     the bottom and top ones from (i,j) and (i+1,j+1). */
+  rect->x = floor (x[k3] + st->vertex_dx) - pad;
+  rect->y = floor (y[k2] + st->vertex_dy) - pad;
+  rect->width = ceil (x[k1] - st->vertex_dx) + pad - rect->x;
+  rect->height = ceil (y[k0] + st->vertex_dy) + pad - rect->y;
+}
+
+/* Return TRUE if the cell (I,J) must be drawn to repaint REGION. A
+   NULL region means the whole board. */
+static gboolean
+cell_visible_p (HexboardPrivate * st, GdkRegion * region, gint i, gint j)
+{
+  GdkRectangle rect;
+  if (region == NULL)
+    return TRUE;
+  cell_extents (st, i, j, st->cell_border[CELL_INDEX (st, i, j)], &rect);
+  return gdk_region_rect_in (region, &rect) != GDK_OVERLAP_RECTANGLE_OUT;
+}
+
+/* Invalidate the area of the cell (I,J) in the window, as if its edge
+   had width BORDER. Inside of an update, the area is added to the
+   pending one instead. */
+static void
+invalidate_cell (Hexboard * hexboard, gint i, gint j, double border)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
+  GdkRectangle rect;
+  if (st->lattice_size != st->size)
+    return;
+  cell_extents (st, i, j, border, &rect);
+  if (st->update_depth == 0)
+    gtk_widget_queue_draw_area (GTK_WIDGET (hexboard), rect.x, rect.y, rect.width, rect.height);
+  else if (st->pending)
+    gdk_rectangle_union (&st->pending_area, &rect, &st->pending_area);
+  else
+    {
+      st->pending_area = rect;
+      st->pending = TRUE;
+    }
+  st->cell_dirty[CELL_INDEX (st, i, j)] = 1;
+}
+
 static inline void
-draw_cell_path (Hexboard * hexboard, cairo_t * cr, gint i, gint j)
+draw_cell_path (HexboardPrivate * st, cairo_t * cr, gint i, gint j)
 {
   /* We want to avoid adjacent vertex to be the different coordinates,
      because it causes seams. So, we take the coordinates of the two
      bottom vertex from each cell. */
-  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
-  double radious = st->cell_width/2;
-  int x0, y0;
-  int x1, y1;
-  int x2, y2;
-  int x3, y3;
-  cell_to_pixel (hexboard, i+0, j+0, &x0, &y0);
-  cell_to_pixel (hexboard, i+1, j+0, &x1, &y1);
-  cell_to_pixel (hexboard, i+1, j+1, &x2, &y2);
-  cell_to_pixel (hexboard, i+0, j+1, &x3, &y3);
-
-  cairo_move_to (cr, x0 - radious/2, y0 + sqrt(3)/2 * radious);
-  cairo_line_to (cr, x0 + radious/2, y0 + sqrt(3)/2 * radious);
-  cairo_line_to (cr, x1 - radious/2, y1 + sqrt(3)/2 * radious);
-  cairo_line_to (cr, x2 + radious/2, y2 + sqrt(3)/2 * radious);
-  cairo_line_to (cr, x2 - radious/2, y2 + sqrt(3)/2 * radious);
-  cairo_line_to (cr, x3 + radious/2, y3 + sqrt(3)/2 * radious);
+  const int * x = st->lattice_x;
+  const int * y = st->lattice_y;
+  double dx = st->vertex_dx;
+  double dy = st->vertex_dy;
+  int k0 = LATTICE_INDEX (st, i+0, j+0);
+  int k1 = LATTICE_INDEX (st, i+1, j+0);
+  int k2 = LATTICE_INDEX (st, i+1, j+1);
+  int k3 = LATTICE_INDEX (st, i+0, j+1);
+  cairo_move_to (cr, x[k0] - dx, y[k0] + dy);
+  cairo_line_to (cr, x[k0] + dx, y[k0] + dy);
+  cairo_line_to (cr, x[k1] - dx, y[k1] + dy);
+  cairo_line_to (cr, x[k2] + dx, y[k2] + dy);
+  cairo_line_to (cr, x[k2] - dx, y[k2] + dy);
+  cairo_line_to (cr, x[k3] + dx, y[k3] + dy);
   cairo_close_path (cr);
 }
 
+/* Draw the borders, the empty cells and the grid of the board in CR,
+   which is what the board looks like before any change to its cells. */
 static void
-draw_board (Hexboard * hexboard, cairo_t * cr, gint width, gint height)
+draw_background (Hexboard * hexboard, cairo_t * cr)
 {
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
-  double radious;
   int n = st->size;
-  int i, j;
   draw_border_se (hexboard, cr,
                   st->border_color[HEXBOARD_BORDER_SE][0],
                   st->border_color[HEXBOARD_BORDER_SE][1],
@@ -420,30 +590,149 @@ draw_board (Hexboard * hexboard, cairo_t * cr, gint width, gint height)
                   st->border_color[HEXBOARD_BORDER_NE][0],
                   st->border_color[HEXBOARD_BORDER_NE][1],
                   st->border_color[HEXBOARD_BORDER_NE][2]);
-  radious = st->cell_width/2;
+  /* The cells are filled and stroked with the same path, as all of
+     them have the default attributes. */
+  cairo_append_path (cr, st->grid_path);
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_fill_preserve (cr);
+  cairo_set_source_rgb (cr, 0, 0, 0);
+  cairo_set_line_width (cr, 1);
+  cairo_stroke (cr);
+}
+
+/* Return TRUE if the cell K is filled as in the background. */
+static inline gboolean
+cell_empty_p (HexboardPrivate * st, int k)
+{
+  return (st->cell_color[0][k] == 1 && st->cell_color[1][k] == 1 && st->cell_color[2][k] == 1
+          && (st->overlay == NULL || isnan (st->overlay[k])));
+}
+
+/* Draw the overlay of the cell (I,J), whose value is VALUE. */
+static void
+draw_cell_overlay (HexboardPrivate * st, cairo_t * cr, gint i, gint j, float value)
+{
+  cairo_set_source_rgba (cr, value, 0, 1 - value, 0.5);
+  draw_cell_path (st, cr, i, j);
+  cairo_fill (cr);
+  if (st->overlay_labels)
+    {
+      char label[8];
+      cairo_text_extents_t extents;
+      int x, y;
+      /* The center of the cell is its point of the lattice. */
+      x = st->lattice_x[LATTICE_INDEX (st, i, j)];
+      y = st->lattice_y[LATTICE_INDEX (st, i, j)];
+      snprintf (label, sizeof(label), "%d", (int)(value * 100 + 0.5));
+      cairo_set_source_rgb (cr, 1, 1, 1);
+      cairo_select_font_face (cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+      cairo_set_font_size (cr, st->cell_height / 3);
+      cairo_text_extents (cr, label, &extents);
+      cairo_move_to (cr,
+                     x - extents.width/2 - extents.x_bearing,
+                     y - extents.height/2 - extents.y_bearing);
+      cairo_show_text (cr, label);
+    }
+}
+
+/* Draw the cells which intersect REGION, or all of them if it is
+   NULL, on top of the background. Only the cells whose attributes
+   differ from the default ones are drawn. */
+static void
+draw_cells (Hexboard * hexboard, cairo_t * cr, GdkRegion * region)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
+  int n = st->size;
+  int i, j;
+  gboolean filled = FALSE;
   /* Cells */
   for (j=0; j<n; j++)
     {
       for (i=0; i<n; i++)
         {
-          cairo_set_source_rgb (cr, st->cells[i][j].r, st->cells[i][j].g, st->cells[i][j].b);
-          draw_cell_path (hexboard, cr, i, j);
+          int k = CELL_INDEX (st, i, j);
+          if (!cell_visible_p (st, region, i, j))
+            continue;
+          st->cell_dirty[k] = 0;
+          if (cell_empty_p (st, k))
+            continue;
+          cairo_set_source_rgb (cr, st->cell_color[0][k], st->cell_color[1][k], st->cell_color[2][k]);
+          draw_cell_path (st, cr, i, j);
           cairo_fill (cr);
+          if (st->overlay && !isnan (st->overlay[k]))
+            draw_cell_overlay (st, cr, i, j, st->overlay[k]);
+          filled = TRUE;
+        }
+    }
+  /* Edges. Filling a cell covers half of the grid line around it, so
+     the outlines of the filled cells are stroked again with the
+     default width, and then the few cells with a different border are
+     stroked on top. */
+  cairo_set_source_rgb (cr, 0, 0, 0);
+  if (filled)
+    {
+      cairo_set_line_width (cr, 1);
+      for (j=0; j<n; j++)
+        {
+          for (i=0; i<n; i++)
+            {
+              int k = CELL_INDEX (st, i, j);
+              if (cell_empty_p (st, k))
+                continue;
+              if (cell_visible_p (st, region, i, j))
+                draw_cell_path (st, cr, i, j);
+            }
         }
+      cairo_stroke (cr);
     }
-  /* Edges */
   for (j=0; j<n; j++)
     {
       for (i=0; i<n; i++)
         {
-          cairo_set_line_width (cr, st->cells[i][j].border);
-          cairo_set_source_rgb (cr, 0, 0, 0);
-          draw_cell_path (hexboard, cr, i , j);
+          double border = st->cell_border[CELL_INDEX (st, i, j)];
+          if (border == 1 || !cell_visible_p (st, region, i, j))
+            continue;
+          cairo_set_line_width (cr, border);
+          draw_cell_path (st, cr, i , j);
           cairo_stroke (cr);
         }
     }
 }
 
+/* Draw the whole board in CR as vector graphics. */
+static void
+draw_board (Hexboard * hexboard, cairo_t * cr)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
+  if (st->lattice_size != st->size)
+    update_geometry (hexboard);
+  draw_background (hexboard, cr);
+  draw_cells (hexboard, cr, NULL);
+}
+
+/* Render the background of the board, with the color of the widget
+   around it, in a surface similar to TARGET and the size of the
+   widget, to be painted on each expose event. */
+static void
+update_background (Hexboard * hexboard, cairo_surface_t * target)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
+  GtkAllocation rect;
+  cairo_t * cr;
+  if (st->lattice_size != st->size)
+    update_geometry (hexboard);
+  if (st->background)
+    cairo_surface_destroy (st->background);
+  gtk_widget_get_allocation (GTK_WIDGET (hexboard), &rect);
+  st->background = cairo_surface_create_similar (target, CAIRO_CONTENT_COLOR,
+                                                 MAX (rect.width, 1), MAX (rect.height, 1));
+  cr = cairo_create (st->background);
+  cairo_set_source_rgb (cr, .8,.8,.8);
+  cairo_paint (cr);
+  draw_background (hexboard, cr);
+  cairo_destroy (cr);
+}
+
 static gboolean
 hexboard_button_press (GtkWidget * widget, GdkEventButton * event)
 {
@@ -464,17 +753,17 @@ hexboard_expose(GtkWidget * widget, GdkEventExpose *event)
   Hexboard * hexboard = HEXBOARD (widget);
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hexboard);
   cairo_t *cr;
-  gint width, height;
-  gdk_window_get_size (GTK_WIDGET(hexboard)->window, &width, &height);
   cr = gdk_cairo_create (GTK_WIDGET(hexboard)->window);
   /* Clip expose region */
-  cairo_rectangle (cr, event->area.x, event->area.y, event->area.width, event->area.height);
+  gdk_cairo_region (cr, event->region);
   cairo_clip(cr);
   /* Background */
-  cairo_set_source_rgb (cr, .8,.8,.8);
+  if (st->background == NULL || st->lattice_size != st->size)
+    update_background (hexboard, cairo_get_target (cr));
+  cairo_set_source_surface (cr, st->background, 0, 0);
   cairo_paint (cr);
-  /* Board */
-  draw_board (hexboard, cr, width, height);
+  /* Board. Only the cells in the exposed region are drawn. */
+  draw_cells (hexboard, cr, event->region);
   cairo_destroy(cr);
   return TRUE;
 }
@@ -483,7 +772,7 @@ GtkWidget *
 hexboard_new (guint size)
 {
   GtkWidget * widget;
-  if (size > 0 && size <= BOARD_MAX_SIZE)
+  if (size > 0)
     {
       widget = g_object_new (TYPE_HEXBOARD, NULL);
       hexboard_set_size (HEXBOARD(widget), size);
@@ -506,9 +795,37 @@ hexboard_set_size (Hexboard * hex, guint size)
 {
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (hex);
   gboolean success;
-  if (size > 0 && size <= BOARD_MAX_SIZE)
+  if (size > 0)
     {
-      st->size = size;
+      if (size != st->size)
+        {
+          guint cells = size * size;
+          guint k;
+          g_free (st->cell_color[0]);
+          st->cell_color[0] = g_new (float, 4 * cells);
+          st->cell_color[1] = st->cell_color[0] + cells;
+          st->cell_color[2] = st->cell_color[0] + 2*cells;
+          st->cell_border = st->cell_color[0] + 3*cells;
+          for (k=0; k<cells; k++)
+            {
+              st->cell_color[0][k] = 1;
+              st->cell_color[1][k] = 1;
+              st->cell_color[2][k] = 1;
+              st->cell_border[k] = 1;
+            }
+          g_free (st->cell_dirty);
+          st->cell_dirty = g_new0 (guint8, cells);
+          /* The overlay is meaningless for another size. */
+          g_free (st->overlay);
+          st->overlay = st->overlay_next = NULL;
+          if (st->overlay_source)
+            {
+              g_source_remove (st->overlay_source);
+              st->overlay_source = 0;
+            }
+          st->size = size;
+          update_geometry (hex);
+        }
       success = TRUE;
       gtk_widget_queue_draw (GTK_WIDGET(hex));
       gtk_widget_queue_resize (GTK_WIDGET(hex));
@@ -525,9 +842,9 @@ hexboard_cell_get_color (Hexboard * board, gint i, gint j, double *r, double *g,
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
   if (i < 0 || i >= st->size || j < 0 || j >= st->size)
     return FALSE;
-  *r = st->cells[i][j].r;
-  *g = st->cells[i][j].g;
-  *b = st->cells[i][j].b;
+  *r = st->cell_color[0][CELL_INDEX (st, i, j)];
+  *g = st->cell_color[1][CELL_INDEX (st, i, j)];
+  *b = st->cell_color[2][CELL_INDEX (st, i, j)];
   return TRUE;
 }
 
@@ -535,12 +852,19 @@ gboolean
 hexboard_cell_set_color (Hexboard * board, gint i, gint j, double r, double g, double b)
 {
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
+  int k;
   if (i < 0 || i >= st->size || j < 0 || j >= st->size)
     return FALSE;
-  st->cells[i][j].r = r;
-  st->cells[i][j].g = g;
-  st->cells[i][j].b = b;
-  gtk_widget_queue_draw (GTK_WIDGET (board));
+  k = CELL_INDEX (st, i, j);
+  if (st->cell_color[0][k] == (float)r
+      && st->cell_color[1][k] == (float)g
+      && st->cell_color[2][k] == (float)b)
+    return TRUE;
+  st->cell_color[0][k] = r;
+  st->cell_color[1][k] = g;
+  st->cell_color[2][k] = b;
+  if (!st->cell_dirty[k])
+    invalidate_cell (board, i, j, st->cell_border[k]);
   return TRUE;
 }
 
@@ -550,7 +874,7 @@ hexboard_cell_get_border (Hexboard * board, gint i, gint j, double * border)
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
   if (i < 0 || i >= st->size || j < 0 || j >= st->size)
     return FALSE;
-  *border = st->cells[i][j].border;
+  *border = st->cell_border[CELL_INDEX (st, i, j)];
   return TRUE;
 }
 
@@ -558,13 +882,138 @@ gboolean
 hexboard_cell_set_border (Hexboard * board, gint i, gint j, double border)
 {
   HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
+  int k;
+  double old;
   if (i < 0 || i >= st->size || j < 0 || j >= st->size)
     return FALSE;
-  st->cells[i][j].border = border;
-  gtk_widget_queue_draw (GTK_WIDGET (board));
+  k = CELL_INDEX (st, i, j);
+  old = st->cell_border[k];
+  if (old == (float)border)
+    return TRUE;
+  st->cell_border[k] = border;
+  /* The area of the cell grows or shrinks with its edge. The dirty
+     flag does not tell which width the area was invalidated with, so
+     it is invalidated again. */
+  invalidate_cell (board, i, j, MAX (old, border));
   return TRUE;
 }
 
+void
+hexboard_begin_update (Hexboard * board)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
+  st->update_depth++;
+}
+
+void
+hexboard_commit_update (Hexboard * board)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
+  GdkRectangle * area = &st->pending_area;
+  g_return_if_fail (st->update_depth > 0);
+  if (--st->update_depth > 0 || !st->pending)
+    return;
+  /* A single rectangle is queued, as the union of the areas of the
+     cells is expensive to build and to clip against. */
+  gtk_widget_queue_draw_area (GTK_WIDGET (board), area->x, area->y, area->width, area->height);
+  st->pending = FALSE;
+}
+
+void
+hexboard_set_cells (Hexboard * board, const float * colors, const float * borders)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
+  guint n = st->size;
+  guint i, j, k;
+  hexboard_begin_update (board);
+  for (j=0; j<n; j++)
+    {
+      for (i=0; i<n; i++)
+        {
+          double border;
+          gboolean changed = FALSE;
+          k = CELL_INDEX (st, i, j);
+          border = st->cell_border[k];
+          if (colors
+              && (st->cell_color[0][k] != colors[3*k+0]
+                  || st->cell_color[1][k] != colors[3*k+1]
+                  || st->cell_color[2][k] != colors[3*k+2]))
+            {
+              st->cell_color[0][k] = colors[3*k+0];
+              st->cell_color[1][k] = colors[3*k+1];
+              st->cell_color[2][k] = colors[3*k+2];
+              changed = TRUE;
+            }
+          if (borders && st->cell_border[k] != borders[k])
+            {
+              border = MAX (border, borders[k]);
+              st->cell_border[k] = borders[k];
+              changed = TRUE;
+            }
+          if (changed)
+            invalidate_cell (board, i, j, border);
+        }
+    }
+  hexboard_commit_update (board);
+}
+
+/* Show the last overlay values set. Only the cells whose level has
+   changed are redrawn. */
+static gboolean
+overlay_timeout (gpointer data)
+{
+  Hexboard * board = HEXBOARD (data);
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
+  guint n = st->size;
+  guint i, j, k;
+  st->overlay_source = 0;
+  for (j=0; j<n; j++)
+    {
+      for (i=0; i<n; i++)
+        {
+          float old, new;
+          k = CELL_INDEX (st, i, j);
+          old = st->overlay[k];
+          new = st->overlay_next[k];
+          if (isnan (old) && isnan (new))
+            continue;
+          if (!isnan (old) && !isnan (new)
+              && (int)(old * OVERLAY_LEVELS) == (int)(new * OVERLAY_LEVELS))
+            continue;
+          st->overlay[k] = new;
+          if (!st->cell_dirty[k])
+            invalidate_cell (board, i, j, st->cell_border[k]);
+        }
+    }
+  return FALSE;
+}
+
+void
+hexboard_set_overlay (Hexboard * board, const float * values, gboolean labels)
+{
+  HexboardPrivate * st = HEXBOARD_GET_PRIVATE (board);
+  guint cells = st->size * st->size;
+  guint k;
+  if (st->overlay == NULL)
+    {
+      if (values == NULL)
+        return;
+      st->overlay = g_new (float, 2 * cells);
+      st->overlay_next = st->overlay + cells;
+      for (k=0; k<cells; k++)
+        st->overlay[k] = NAN;
+    }
+  for (k=0; k<cells; k++)
+    st->overlay_next[k] = values? CLAMP (values[k], 0, 1): NAN;
+  if (labels != st->overlay_labels)
+    {
+      st->overlay_labels = labels;
+      gtk_widget_queue_draw (GTK_WIDGET (board));
+    }
+  if (st->overlay_source == 0)
+    st->overlay_source = g_timeout_add (OVERLAY_INTERVAL, overlay_timeout, board);
+}
+
 void
 hexboard_border_get_color (Hexboard * board, HexboardBorder border, double *r, double *g, double *b)
 {
@@ -581,6 +1030,11 @@ hexboard_border_set_color (Hexboard * board, HexboardBorder border, double r, do
   st->border_color[border][0] = r;
   st->border_color[border][1] = g;
   st->border_color[border][2] = b;
+  if (st->background)
+    {
+      cairo_surface_destroy (st->background);
+      st->background = NULL;
+    }
   gtk_widget_queue_draw (GTK_WIDGET(board));
 }
 
@@ -604,7 +1058,7 @@ hexboard_save_as_image (Hexboard * hex, const char * filename, const char * type
     return FALSE;
 
   cr = cairo_create (surf);
-  draw_board (hex, cr, width, height);
+  draw_board (hex, cr);
   cairo_surface_flush (surf);
 
   if (!strcasecmp (type, "png"))
@@ -42,9 +42,11 @@
 
 typedef struct _Hexboard Hexboard;
 typedef struct _HexboardClass HexboardClass;
+typedef struct _HexboardPrivate HexboardPrivate;
 
 struct _Hexboard {
   GtkDrawingArea widget;
+  HexboardPrivate * priv;
 };
 
 struct _HexboardClass {
@@ -74,6 +76,28 @@ gboolean hexboard_cell_get_color (Hexboard * board, gint i, gint j, double *r, d
 gboolean hexboard_cell_set_border (Hexboard * board, gint i, gint j, double border);
 gboolean hexboard_cell_get_border (Hexboard * board, gint i, gint j, double * border);
 
+/* Changes of the cells between hexboard_begin_update and
+   hexboard_commit_update are drawn at once when the latter is
+   called. The calls can be nested. */
+void hexboard_begin_update (Hexboard * board);
+void hexboard_commit_update (Hexboard * board);
+
+/* Set the attributes of every cell at once. COLORS are the red, green
+   and blue components of each cell and BORDERS their border widths,
+   both in the order (0,0), (1,0)... (size-1,size-1). Either of them
+   can be NULL to leave that attribute unchanged. */
+void hexboard_set_cells (Hexboard * board, const float * colors, const float * borders);
+
+/* Show VALUES, an array with a number between 0 and 1 for each cell
+   in the order of hexboard_set_cells, as a translucent color on top
+   of the cells, from blue for 0 to red for 1. Cells whose value is
+   NaN are left as they are. If LABELS is TRUE, the values are also
+   written on the cells as percentages. The values are copied, and the
+   board shows the last ones at most a few times per second, so this
+   can be called for every update of a running analysis. VALUES can be
+   NULL to remove the overlay. */
+void hexboard_set_overlay (Hexboard * board, const float * values, gboolean labels);
+
 void hexboard_border_set_color (Hexboard * board, HexboardBorder border, double r, double g, double b);
 void hexboard_border_get_color (Hexboard * board, HexboardBorder border, double *r, double *g, double *b);
 
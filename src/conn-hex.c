@@ -26,36 +26,58 @@
 #include <errno.h>
 #include <glib.h>
 #include "conn-hex.h"
+#include "conn-bitboard.h"
 #include "sgftree.h"
 
-struct hex_cell_s {
-  unsigned int a_connected : 1;
-  unsigned int z_connected : 1;
-  unsigned int player : 2;
+/* A history entry is the cell (i,j) of the move, whether it ended the
+   game and the size of the trail before the move was done. */
+typedef int history_entry[4];
+
+/* Trail of changes done to the union-find structure, so that they can
+   be undone when we go backward in the history. Each entry is the
+   union of the root CHILD into the root ROOT. */
+struct trail_entry_s {
+  guint32 child;
+  guint32 root;
+  guint8 borders;               /* Previous borders of ROOT */
+  guint8 rank_incremented;      /* Whether ROOT's rank was incremented */
 };
 
-typedef int history_entry[3];
+/* A stone touches at most three different groups of its player. */
+#define TRAIL_ENTRIES_PER_MOVE 3
+
 struct hex_s
 {
   size_t size;
   boolean end_of_game_p;
   int player;
-  struct hex_cell_s * board;
+  /* The board is kept as bitboards. For each player (index player-1),
+     STONES is the set of cells of the player. */
+  bitboard_layout_t layout;
+  bitboard_t stones[2];
+  /* Groups of stones are kept in a union-find structure with a node
+     for each cell. The root of each set carries the borders which the
+     group touches in BORDERS, so a stone is a-connected (resp.
+     z-connected) if the root of its set has the A_CONNECTED (resp.
+     Z_CONNECTED) bit. */
+  guint32 * parent;
+  guint8 * rank;
+  guint8 * borders;
+  unsigned int trail_size;
+  struct trail_entry_s * trail;
+  /* Zobrist hash of the position. ZOBRIST has a random key for each
+     cell and player (index 2*k + player-1), and HASH is the xor of the
+     keys of the stones on the board. */
+  guint64 hash;
+  guint64 * zobrist;
   /* History */
   unsigned int history_size;
   unsigned int history_current;
   history_entry *history;
 };
 
-typedef unsigned char hex_cell_t;
-
-/* Static functions */
-static void expand_a_connection (hex_t hex, uint i, uint j);
-static void expand_z_connection (hex_t hex, uint i, uint j);
-static void recompute_setting (hex_t hex);
-
 /* Macro to easy board access */
-#define CELL(hex,i,j) ((hex)->board[(j)*((hex)->size) + (i)])
+#define CELL_INDEX(hex,i,j) ((j)*((hex)->size) + (i))
 
 /* Check if there is a (i,j)-cell in the board HEX. */
 #define IN_BOARD_P(hex,i,j) (i>=0 && i<(hex)->size && j>=0 && j<(hex)->size)
@@ -63,16 +85,66 @@ static void recompute_setting (hex_t hex);
 /* Switch player */
 #define SWITCH_PLAYER(hex) ((hex)->player = (hex)->player%2 + 1)
 
+/* The a-border and z-border of each player. */
+#define A_BORDER(hex,player) \
+  (bitboard_layout_edge ((hex)->layout, (player) == 1 ? BITBOARD_FIRST_ROW : BITBOARD_FIRST_COLUMN))
+#define Z_BORDER(hex,player) \
+  (bitboard_layout_edge ((hex)->layout, (player) == 1 ? BITBOARD_LAST_ROW : BITBOARD_LAST_COLUMN))
+
+/* Borders touched by a group of stones. The borders are not nodes of
+   the union-find structure, otherwise two groups would be merged
+   through the border they both touch. */
+#define A_CONNECTED 1
+#define Z_CONNECTED 2
+
+/* Seed of the Zobrist keys. It is fixed, so the hash of a position is
+   the same across runs and can be stored. */
+#define ZOBRIST_SEED G_GUINT64_CONSTANT(0x436f6e6e65637469)
+
+/* Relative coordinates of the neighbors of a cell. */
+static const int neighbors[6][2] = {{+1, 0}, {+1, +1}, {0, +1},
+                                    {-1, 0}, {-1, -1}, {0, -1}};
+
+
+/* Return the next number of the SplitMix64 sequence of STATE. */
+static guint64
+splitmix64 (guint64 * state)
+{
+  guint64 z = (*state += G_GUINT64_CONSTANT(0x9e3779b97f4a7c15));
+  z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94d049bb133111eb);
+  return z ^ (z >> 31);
+}
+
 
 /* Construction and destruction */
 hex_t
 hex_new (size_t size)
 {
   hex_t hex;
+  bitboard_t planes;
+  size_t words;
+  guint64 seed;
+  size_t k;
+  int t;
   hex = (hex_t)g_malloc (sizeof(struct hex_s));
-  hex->board = g_malloc (size*size * sizeof(struct hex_cell_s));
+  hex->layout = bitboard_layout_new (size);
+  words = bitboard_layout_words (hex->layout);
+  planes = g_malloc (2 * words * sizeof(guint64));
+  for (t=0; t<2; t++)
+    hex->stones[t] = planes + t * words;
   hex->history = g_malloc (sizeof(history_entry) * size * size);
   hex->size = size;
+  hex->parent = g_malloc (size*size * sizeof(guint32));
+  hex->rank = g_malloc (size*size * sizeof(guint8));
+  hex->borders = g_malloc (size*size * sizeof(guint8));
+  hex->trail = g_malloc (TRAIL_ENTRIES_PER_MOVE * size*size * sizeof(struct trail_entry_s));
+  /* The keys depend on the size, so the same stones on boards of
+     different size have different hashes. */
+  hex->zobrist = g_malloc (2 * size*size * sizeof(guint64));
+  seed = ZOBRIST_SEED ^ size;
+  for (k=0; k<2*size*size; k++)
+    hex->zobrist[k] = splitmix64 (&seed);
   hex_reset (hex);
   return hex;
 }
@@ -81,7 +153,16 @@ void
 hex_reset (hex_t hex)
 {
   size_t size = hex->size;
-  memset (hex->board, 0, sizeof(struct hex_cell_s) * size * size);
+  size_t words = bitboard_layout_words (hex->layout);
+  size_t k;
+  /* Both planes are allocated as a single block. */
+  memset (hex->stones[0], 0, 2 * words * sizeof(guint64));
+  for (k=0; k<size*size; k++)
+    hex->parent[k] = k;
+  memset (hex->rank, 0, size*size * sizeof(guint8));
+  memset (hex->borders, 0, size*size * sizeof(guint8));
+  hex->trail_size = 0;
+  hex->hash = 0;
   hex->player = 1;
   hex->end_of_game_p = 0;
   hex->history_size = 0;
@@ -97,10 +178,124 @@ hex_size (hex_t hex)
 void
 hex_free (hex_t hex)
 {
-  g_free (hex->board);
+  g_free (hex->stones[0]);
+  bitboard_layout_free (hex->layout);
+  g_free (hex->parent);
+  g_free (hex->rank);
+  g_free (hex->borders);
+  g_free (hex->trail);
+  g_free (hex->zobrist);
+  g_free (hex->history);
   g_free (hex);
 }
 
+/* Union-find */
+
+/* Return the representative of the set of the node K. Paths are not
+   compressed, so that unions can be undone in the reverse order. The
+   union by rank keeps the trees logarithmic anyway. */
+static inline guint32
+uf_find (hex_t hex, guint32 k)
+{
+  guint32 * parent = hex->parent;
+  while (parent[k] != k)
+    k = parent[k];
+  return k;
+}
+
+/* Merge the sets of the nodes K1 and K2, by rank. The change is
+   recorded in the trail. */
+static inline void
+uf_union (hex_t hex, guint32 k1, guint32 k2)
+{
+  guint32 r1 = uf_find (hex, k1);
+  guint32 r2 = uf_find (hex, k2);
+  struct trail_entry_s * entry;
+  if (r1 == r2)
+    return;
+  if (hex->rank[r1] < hex->rank[r2])
+    {
+      guint32 tmp = r1;
+      r1 = r2;
+      r2 = tmp;
+    }
+  assert (hex->trail_size < TRAIL_ENTRIES_PER_MOVE * hex->size * hex->size);
+  entry = &hex->trail[hex->trail_size++];
+  entry->child = r2;
+  entry->root = r1;
+  entry->borders = hex->borders[r1];
+  entry->rank_incremented = (hex->rank[r1] == hex->rank[r2]);
+  hex->parent[r2] = r1;
+  hex->borders[r1] |= hex->borders[r2];
+  hex->rank[r1] += entry->rank_incremented;
+}
+
+/* Undo the unions recorded in the trail after the first MARK
+   entries. */
+static void
+uf_rollback (hex_t hex, unsigned int mark)
+{
+  while (hex->trail_size > mark)
+    {
+      struct trail_entry_s * entry = &hex->trail[--hex->trail_size];
+      hex->parent[entry->child] = entry->child;
+      hex->borders[entry->root] = entry->borders;
+      hex->rank[entry->root] -= entry->rank_incremented;
+    }
+}
+
+/* Return the borders touched by the group of the node K. */
+static inline guint8
+uf_borders (hex_t hex, guint32 k)
+{
+  return hex->borders[uf_find (hex, k)];
+}
+
+/* Make a new set for the stone of PLAYER in the cell K. */
+static inline void
+uf_make_set (hex_t hex, int player, guint32 k)
+{
+  hex->parent[k] = k;
+  hex->rank[k] = 0;
+  hex->borders[k] = 0;
+  if (BITBOARD_TEST (A_BORDER (hex, player), k))
+    hex->borders[k] |= A_CONNECTED;
+  if (BITBOARD_TEST (Z_BORDER (hex, player), k))
+    hex->borders[k] |= Z_CONNECTED;
+}
+
+/* Join the stone of PLAYER at (I,J) to the adjacent stones of the
+   same player. */
+static void
+uf_join_stone (hex_t hex, int player, uint i, uint j)
+{
+  guint32 k = CELL_INDEX(hex,i,j);
+  bitboard_t stones = hex->stones[player-1];
+  int t;
+  for (t=0; t<6; t++)
+    {
+      uint i1 = i + neighbors[t][0];
+      uint j1 = j + neighbors[t][1];
+      if (IN_BOARD_P (hex, i1, j1) && BITBOARD_TEST (stones, CELL_INDEX(hex,i1,j1)))
+        uf_union (hex, k, CELL_INDEX(hex,i1,j1));
+    }
+}
+
+/* Put a stone of PLAYER at the free cell (I,J) and merge it with the
+   groups it touches. Return TRUE if the stone connects both borders
+   of the player. */
+static boolean
+place_stone (hex_t hex, int player, uint i, uint j)
+{
+  guint32 k = CELL_INDEX(hex,i,j);
+  BITBOARD_SET (hex->stones[player-1], k);
+  hex->hash ^= hex->zobrist[2*k + player-1];
+  uf_make_set (hex, player, k);
+  uf_join_stone (hex, player, i, j);
+  return uf_borders (hex, k) == (A_CONNECTED | Z_CONNECTED);
+}
+
+
 /* History */
 
 static boolean
@@ -115,8 +310,10 @@ history_backward (hex_t hex)
   i = hex->history[current][0];
   j = hex->history[current][1];
   hex->end_of_game_p = 0;
-  CELL(hex,i,j).player = 0;
   SWITCH_PLAYER (hex);
+  BITBOARD_RESET (hex->stones[hex->player-1], CELL_INDEX(hex,i,j));
+  hex->hash ^= hex->zobrist[2*CELL_INDEX(hex,i,j) + hex->player-1];
+  uf_rollback (hex, hex->history[current][3]);
   return TRUE;
 }
 
@@ -130,7 +327,7 @@ history_forward (hex_t hex)
   i = hex->history[current][0];
   j = hex->history[current][1];
   hex->end_of_game_p = hex->history[current][2];
-  CELL (hex,i,j).player = hex->player;
+  place_stone (hex, hex->player, i, j);
   SWITCH_PLAYER (hex);
   hex->history_current++;
   return TRUE;
@@ -150,7 +347,6 @@ hex_history_jump (hex_t hex, unsigned int n)
       for(; current>n; current--)
         history_backward (hex);
     }
-  recompute_setting (hex);
   return current;
 }
 
@@ -193,11 +389,24 @@ hex_history_last_move (hex_t hex, uint *i, uint *j)
 
 /* Examining the board */
 
+/* Return the player who owns the cell K of HEX, or 0 if it is
+   free. */
+static inline int
+cell_player (hex_t hex, size_t k)
+{
+  if (BITBOARD_TEST (hex->stones[0], k))
+    return 1;
+  else if (BITBOARD_TEST (hex->stones[1], k))
+    return 2;
+  else
+    return 0;
+}
+
 int
 hex_cell_player (hex_t hex, uint i, uint j)
 {
   if (IN_BOARD_P(hex,i,j))
-    return CELL(hex, i, j).player;
+    return cell_player (hex, CELL_INDEX(hex,i,j));
   else
     return -1;
 }
@@ -207,7 +416,7 @@ int
 hex_cell_player1_p (hex_t hex, uint i, uint j)
 {
   if (IN_BOARD_P(hex,i,j))
-    return CELL(hex, i, j).player == 1;
+    return BITBOARD_TEST (hex->stones[0], CELL_INDEX(hex,i,j));
   else
     return -1;
 }
@@ -216,7 +425,7 @@ int
 hex_cell_player2_p (hex_t hex, uint i, uint j)
 {
   if (IN_BOARD_P(hex,i,j))
-    return CELL(hex,i,j).player == 2;
+    return BITBOARD_TEST (hex->stones[1], CELL_INDEX(hex,i,j));
   else
     return -1;
 }
@@ -224,8 +433,8 @@ hex_cell_player2_p (hex_t hex, uint i, uint j)
 int
 hex_cell_a_connected_p (hex_t hex, uint i, uint j)
 {
-  if (IN_BOARD_P(hex, i, j) && CELL(hex,i,j).player != 0)
-    return CELL(hex,i,j).a_connected;
+  if (IN_BOARD_P(hex, i, j) && cell_player (hex, CELL_INDEX(hex,i,j)) != 0)
+    return (uf_borders (hex, CELL_INDEX(hex,i,j)) & A_CONNECTED) != 0;
   else
     return -1;
 }
@@ -233,8 +442,8 @@ hex_cell_a_connected_p (hex_t hex, uint i, uint j)
 int
 hex_cell_z_connected_p (hex_t hex, uint i, uint j)
 {
-  if (IN_BOARD_P(hex, i, j) && CELL(hex,i,j).player != 0)
-    return CELL(hex,i,j).z_connected;
+  if (IN_BOARD_P(hex, i, j) && cell_player (hex, CELL_INDEX(hex,i,j)) != 0)
+    return (uf_borders (hex, CELL_INDEX(hex,i,j)) & Z_CONNECTED) != 0;
   else
     return -1;
 }
@@ -243,7 +452,7 @@ int
 hex_cell_busy_p (hex_t hex, uint i, uint j)
 {
   if (IN_BOARD_P(hex, i, j))
-    return CELL(hex,i,j).player != 0;
+    return cell_player (hex, CELL_INDEX(hex,i,j)) != 0;
   else
     return -1;
 }
@@ -252,7 +461,7 @@ int
 hex_cell_free_p (hex_t hex, uint i, uint j)
 {
   if (IN_BOARD_P(hex, i, j))
-    return CELL(hex, i, j).player == 0;
+    return cell_player (hex, CELL_INDEX(hex,i,j)) == 0;
   else
     return -1;
 }
@@ -271,134 +480,79 @@ hex_get_player (hex_t hex)
   return hex->player;
 }
 
-static void
-expand_a_connection (hex_t hex, uint i, uint j)
+/* Return the Zobrist hash of the current position of HEX. Positions
+   with the same stones on boards of the same size have the same hash,
+   whatever the order of the moves. */
+uint64_t
+hex_hash (hex_t hex)
 {
-  int neighbors[6][2] = {{+1, 0}, {+1, +1}, {0, +1},
-                         {-1, 0}, {-1, -1}, {0, -1}};
-  int t;
-  int player;
-  player = CELL(hex,i,j).player;
-  assert (player != 0);
-  if (!CELL(hex, i, j).a_connected)
-    return;
-
-  for (t=0; t<6; t++)
-    {
-      int i1 = i + neighbors[t][0];
-      int j1 = j + neighbors[t][1];
-      if (IN_BOARD_P (hex, i1, j1) && CELL(hex,i1, j1).player == player
-          && !CELL(hex,i1, j1).a_connected)
-        {
-          CELL(hex,i1, j1).a_connected = 1;
-          expand_a_connection (hex, i1, j1);
-        }
-    }
+  return hex->hash;
 }
 
+/* Load/Save with Smart Game Format */
 
-static void
-expand_z_connection (hex_t hex, uint i, uint j)
-{
-  int neighbors[6][2] = {{+1, 0}, {+1, +1}, {0, +1},
-                         {-1, 0}, {-1, -1}, {0, -1}};
-  int t;
-  int player;
-  player = CELL(hex,i,j).player;
-  assert (player != 0);
-  if (!CELL(hex,i, j).z_connected)
-    return;
-
-  for (t=0; t<6; t++)
-    {
-      int i1 = i + neighbors[t][0];
-      int j1 = j + neighbors[t][1];
-      if (IN_BOARD_P (hex, i1, j1) && CELL(hex,i1, j1).player == player
-          && !CELL(hex,i1, j1).z_connected)
-        {
-          CELL(hex,i1, j1).z_connected = 1;
-          expand_z_connection (hex, i1, j1);
-        }
-    }
-}
-
-/* Recompute all connection properties for a board. It is required
-   when you remove some information from the board. For example, after
-   a `undo'. */
-static void
-recompute_setting (hex_t hex)
+/* Write the decimal digits of N at P and return the end of them. */
+static char *
+hex_sgf_put_uint (char * p, unsigned int n)
 {
-  size_t size = hex->size;
-  int i,j;
-  /* Clean previous connection properties */
-  for (j=0; j<size; j++)
+  char digits[16];
+  int k = 0;
+  do
     {
-      for (i=0; i<size; i++)
-        CELL(hex,i,j).a_connected =
-          CELL(hex,i,j).z_connected = 0;
-    }
-  /* a-connection for player 1 */
-  for (i=0; i<size; i++)
-    {
-      if (CELL(hex,i,0).player == 1)
-        {
-          CELL(hex,i,0).a_connected = 1;
-          expand_a_connection (hex, i, 0);
-        }
-    }
-  /* z-connection for player 1 */
-  for (i=0; i<size; i++)
-    {
-      if (CELL(hex,i,size-1).player == 1)
-        {
-          CELL(hex,i,size-1).z_connected = 1;
-          expand_z_connection (hex, i, size-1);
-        }
-    }
-  /* a-connection for player 2 */
-  for (j=0; j<size; j++)
-    {
-      if (CELL(hex,0,j).player == 2)
-        {
-          CELL(hex,0,j).a_connected = 1;
-          expand_a_connection (hex, 0, j);
-        }
-    }
-  /* z-connection for player 2 */
-  for (j=0; j<size; j++)
-    {
-      if (CELL(hex,size-1,j).player == 2)
-        {
-          CELL(hex,size-1,j).z_connected = 1;
-          expand_z_connection (hex, size-1, j);
-        }
+      digits[k++] = '0' + n % 10;
+      n /= 10;
     }
+  while (n);
+  while (k)
+    *p++ = digits[--k];
+  return p;
 }
 
-
-/* Load/Save with Smart Game Format */
-
 boolean
 hex_save_sgf (hex_t hex, hex_format_t format, char * filename)
 {
-  FILE * file;
+  SGFWriter sgf;
+  char * p;
+  boolean saved;
   int k;
   if (format != HEX_SGF && format != HEX_LG_SGF)
     return FALSE;
-  file = fopen (filename, "w");
-  fprintf(file, "(;FF[4]SZ[%i]", hex->size);
+  if (hex->size > HEX_SGF_MAX_SIZE)
+    return FALSE;
+  /* The game is formatted in memory, a move in 15 characters at most,
+     and written at once, with the same writer as writesgf. */
+  sgfWriterInit (&sgf);
+  sgfWriterReserve (&sgf, 32 + 15 * hex->history_size);
+  p = sgf.data;
+  memcpy (p, "(;FF[4]SZ[", 10);
+  p = hex_sgf_put_uint (p + 10, hex->size);
+  *p++ = ']';
   for (k=0; k<hex->history_size; k++)
     {
       int i = hex->history[k][0];
       int j = hex->size-1-hex->history[k][1];
+      *p++ = ';';
       if (format == HEX_SGF)
-        fprintf (file, ";%c[%c%i]", k%2 ? 'W' : 'B', 'a' + i, j);
+        {
+          *p++ = k%2 ? 'W' : 'B';
+          *p++ = '[';
+          *p++ = 'a' + i;
+          p = hex_sgf_put_uint (p, j);
+        }
       else
-        fprintf (file, ";%c[%c%c]", k%2 ? 'B' : 'W', 'a' + i, 'a' + j);
+        {
+          *p++ = k%2 ? 'B' : 'W';
+          *p++ = '[';
+          *p++ = 'a' + i;
+          *p++ = 'a' + j;
+        }
+      *p++ = ']';
     }
-  fputc (')', file);
-  fclose (file);
-  return TRUE;
+  *p++ = ')';
+  sgf.length = p - sgf.data;
+  saved = sgfWriteFileAtomically (filename, sgf.data, sgf.length);
+  sgfWriterFree (&sgf);
+  return saved;
 }
 
 static int
@@ -412,15 +566,13 @@ hex_decode_sgf_pos (char car)
     return -1;
 }
 
+/* Replay the game of the SGF tree ROOT. */
 hex_t
-hex_load_sgf (hex_format_t format, char * filename)
+hex_load_sgf_tree (hex_format_t format, SGFNode * root)
 {
   hex_t hex;
   char * size_str;
-  SGFNode * root;
   SGFNode * node;
-  if ((root = readsgffile (filename)) == NULL)
-    return NULL;
   if (! sgfGetCharProperty (root, "SZ", &size_str))
     return NULL;
   hex = hex_new (atoi (size_str));
@@ -439,41 +591,55 @@ hex_load_sgf (hex_format_t format, char * filename)
           else if (sgfGetCharProperty (node, "B ", &move))
             format = HEX_SGF;
           else
-            return NULL;
+            goto fail;
           break;
         case HEX_SGF:
           sgfGetCharProperty (node, hex_get_player (hex) == 1 ? "B " : "W ", &move);
           if (! (strcmp ("swap-sides", move) || strcmp ("swap-pieces", move)))
-            return NULL;
+            goto fail;
           if (! strcmp ("resign", move))
             goto end;
           break;
         case HEX_LG_SGF:
           sgfGetCharProperty (node, hex_get_player (hex) == 1 ? "W " : "B ", &move);
           if (! strcmp ("swap", move))
-            return NULL;
+            goto fail;
           if (! strcmp ("resign", move))
             goto end;
           break;
         default:
-          return NULL;
+          goto fail;
         }
 
       errno = 0;
       i = hex_decode_sgf_pos (move[0]);
       if (errno || i >= hex->size)
-        return NULL;
+        goto fail;
 
       if (format == HEX_SGF)
         x = atoi (move+1);
       else if (format == HEX_LG_SGF)
         x = hex_decode_sgf_pos (move[1]);
       if (errno || x >= hex->size)
-        return NULL;
+        goto fail;
 
       hex_move (hex, i, hex->size-x-1);
     }
  end:
+  return hex;
+ fail:
+  hex_free (hex);
+  return NULL;
+}
+
+hex_t
+hex_load_sgf (hex_format_t format, char * filename)
+{
+  hex_t hex;
+  SGFNode * root;
+  if ((root = readsgffile (filename)) == NULL)
+    return NULL;
+  hex = hex_load_sgf_tree (format, root);
   sgfFreeNode (root);
   return hex;
 }
@@ -491,44 +657,8 @@ hex_move_1 (hex_t hex, int player, uint i, uint j)
 
   if (hex_cell_free_p(hex, i, j))
     {
-      int player = hex->player;
-      int size = hex->size;
-      int neighbors[6][2] = {{+1, 0}, {+1, +1}, {0, +1},
-                             {-1, 0}, {-1, -1}, {0, -1}};
-      int t;
-      CELL(hex,i,j).player = player;
-      /* Borders are connected for each user. */
-      if (player == 1)
-        {
-          CELL(hex,i,j).a_connected = (j == 0);
-          CELL(hex,i,j).z_connected = (j == size-1);
-        }
-      else
-        {
-          CELL(hex,i,j).a_connected = (i == 0);
-          CELL(hex,i,j).z_connected = (i == size-1);
-        }
-      /* Inherit connection properties. If some adjacent cell is
-         a-connected (resp. z-connected), then the cell is a-connected
-         (resp. z-connected). */
-      for (t=0; t<6; t++)
-        {
-          int di = neighbors[t][0];
-          int dj = neighbors[t][1];
-          int i1 = i+di;
-          int j1 = j+dj;
-          if (IN_BOARD_P (hex, i1, j1) && CELL(hex, i1, j1).player == player)
-            {
-              CELL(hex, i, j).a_connected |= CELL(hex, i1, j1).a_connected;
-              CELL(hex, i, j).z_connected |= CELL(hex, i1, j1).z_connected;
-            }
-        }
-      /* Propagate connection properties */
-      expand_a_connection (hex, i, j);
-      expand_z_connection (hex, i, j);
-
       /* Check game over */
-      if (CELL(hex,i,j).a_connected && CELL(hex,i,j).z_connected)
+      if (place_stone (hex, hex->player, i, j))
         hex->end_of_game_p = 1;
 
       return HEX_SUCCESS;
@@ -544,17 +674,19 @@ hex_move (hex_t hex, uint i, uint j)
 {
   hex_status_t status;
   unsigned int current;
+  unsigned int mark = hex->trail_size;
   status = hex_move_1 (hex, hex->player, i, j);
   if (status == HEX_SUCCESS)
     {
       SWITCH_PLAYER (hex);
-      /* Truncate the 'future' history */
-      if (hex->history_current < hex->history_size)
-        recompute_setting (hex);
+      /* The 'future' history is truncated below. The union-find
+         structure is exact at any point of the history, so there is
+         nothing to recompute. */
       current = hex->history_current;
       hex->history[current][0] = i;
       hex->history[current][1] = j;
       hex->history[current][2] = hex->end_of_game_p;
+      hex->history[current][3] = mark;
       hex->history_current++;
       hex_truncate_history (hex);
     }
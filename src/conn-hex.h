@@ -20,9 +20,11 @@
 #ifndef CONN_HEX_H
 #define CONN_HEX_H
 
-#include "utils.h"
+#include "conn-types.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include "sgftree.h"
 
 typedef struct hex_s * hex_t;
 
@@ -50,6 +52,7 @@ boolean hex_history_last_move (hex_t hex, uint *i, uint *j);
 hex_status_t hex_move (hex_t hex, uint i, uint j);
 int hex_get_player (hex_t hex);
 boolean hex_end_of_game_p (hex_t hex);
+uint64_t hex_hash (hex_t hex);
 
 /* Load/Save */
 typedef enum {
@@ -61,7 +64,11 @@ typedef enum {
   HEX_LG_SGF
 } hex_format_t;
 
+/* The largest board which can be saved: columns are a single letter. */
+#define HEX_SGF_MAX_SIZE 26
+
 hex_t hex_load_sgf (hex_format_t format, char * filename);
+hex_t hex_load_sgf_tree (hex_format_t format, SGFNode * root);
 boolean hex_save_sgf (hex_t hex, hex_format_t format, char * filename);
 
 /* Examining the board */
@@ -0,0 +1,837 @@
+/* conn-mcts.c --- Monte Carlo tree search player */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "conn-hex.h"
+#include "conn-bitboard.h"
+#include "conn-mcts.h"
+
+/* This is a plain UCT search. The playouts take advantage of the fact
+   that Hex has no draws, and that the winner does not depend on the
+   order of the moves once the board is full: a playout fills the
+   empty cells at random, alternating players, and it checks the
+   winner once at the end with a flood fill over the bitboard of the
+   first player.
+
+   The search may run in several threads sharing the same tree. The
+   statistics of the nodes are updated with atomic operations, and a
+   thread counts its visit to a node as soon as it descends through
+   it, but the win only after the playout. Until then, the visit works
+   as a virtual loss which makes the other threads prefer different
+   paths. A node is expanded by the first thread which flags it, and
+   the children are taken from a node pool allocated in advance.
+
+   That is the tree-parallel mode. In the root-parallel mode every
+   thread grows its own tree, in its own part of the pool, and the
+   statistics of the moves of the roots are added at the end. In the
+   leaf-parallel mode only the calling thread walks the tree, and all
+   the threads run a batch of playouts from each leaf it reaches. */
+
+#define DEFAULT_PLAYOUTS 100000
+#define DEFAULT_EXPLORATION 0.7
+#define DEFAULT_EXPAND_THRESHOLD 1
+#define DEFAULT_MAX_NODES (1 << 20)
+#define DEFAULT_THREADS 1
+#define DEFAULT_MODE MCTS_TREE_PARALLEL
+#define DEFAULT_LEAF_BATCH 16
+
+/* How many playouts are run between two checks of the clock. */
+#define CLOCK_CHECK_INTERVAL 256
+
+/* How many playouts of the budget a thread claims at once. */
+#define CLAIM_BATCH 64
+
+/* The exploration term of UCT needs 1/sqrt(visits) of every child at
+   every step of the selection. It is tabulated for small counts, which
+   are the most frequent ones. */
+#define INV_SQRT_TABLE_SIZE 4096
+
+/* Nodes of the tree live in a pool and refer to each other by index.
+   The children of a node are contiguous in the pool. The index 0 is
+   the root, so it never is a child. FIRST_CHILD and CHILDREN are
+   only meaningful once STATE is NODE_EXPANDED. */
+enum {
+  NODE_LEAF,
+  NODE_EXPANDING,
+  NODE_EXPANDED
+};
+
+struct mcts_node_s
+{
+  guint32 first_child;
+  guint32 children;
+  guint32 move;                 /* Cell index of the move */
+  volatile gint state;
+  volatile gint visits;
+  volatile gint wins;           /* Wins of the player who moved */
+};
+
+/* A tree and the part of the node pool where it grows. */
+struct mcts_tree_s
+{
+  struct mcts_node_s * nodes;
+  size_t max_nodes;
+  volatile gint nodes_used;
+};
+
+/* The state of a search thread. */
+struct mcts_worker_s
+{
+  mcts_t mcts;
+  struct mcts_tree_s * tree;
+  GThread * thread;
+  /* Scratch space of an iteration */
+  bitboard_t scratch[2];
+  guint32 * path;
+  guint32 * empty;
+  guint64 random;
+  unsigned long playouts;
+};
+
+struct mcts_s
+{
+  mcts_options_t options;
+  size_t size;
+  bitboard_layout_t layout;
+  size_t words;
+  /* The root position */
+  int player;
+  bitboard_t stones[2];
+  /* Node pool */
+  struct mcts_node_s * nodes;
+  struct mcts_tree_s * trees;
+  uint ntrees;
+  float * inv_sqrt;
+  /* Threads */
+  struct mcts_worker_s * workers;
+  volatile gint claimed;
+  volatile gint stop;
+  /* Set by mcts_stop. Unlike STOP, it is never cleared, and in the
+     leaf-parallel mode only the first thread looks at it, so the
+     others are always stopped by it under LEAF_LOCK. */
+  volatile gint cancelled;
+  gint64 start;
+  /* The leaf whose playouts are run by all the threads in the
+     leaf-parallel mode. A new leaf is announced by incrementing
+     GENERATION, and the threads report they are done by decrementing
+     PENDING. Both are protected by LEAF_LOCK. */
+  GMutex leaf_lock;
+  GCond leaf_cond;
+  gint leaf_generation;
+  gint leaf_pending;
+  int leaf_player;
+  gint leaf_playouts;
+  volatile gint leaf_wins;
+  bitboard_t leaf_stones[2];
+  /* Statistics */
+  unsigned long playouts;
+  double seconds;
+};
+
+#define OTHER_PLAYER(player) ((player)%2 + 1)
+
+
+/* Random numbers */
+
+/* Return the next number of the xorshift64* sequence of WORKER. */
+static inline guint64
+random_next (struct mcts_worker_s * worker)
+{
+  guint64 x = worker->random;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  worker->random = x;
+  return x * G_GUINT64_CONSTANT(2685821657736338717);
+}
+
+/* Return a random number in the range [0, N). */
+static inline guint32
+random_below (struct mcts_worker_s * worker, guint32 n)
+{
+  return ((random_next (worker) >> 32) * n) >> 32;
+}
+
+/* Return the index of the lowest bit set in the non-zero word X. */
+static inline int
+lowest_bit (guint64 x)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll (x);
+#else
+  int n = 0;
+  while (!(x & 1))
+    {
+      x >>= 1;
+      n++;
+    }
+  return n;
+#endif
+}
+
+
+/* Construction and destruction */
+
+void
+mcts_options_init (mcts_options_t * options)
+{
+  options->playouts = DEFAULT_PLAYOUTS;
+  options->seconds = 0;
+  options->exploration = DEFAULT_EXPLORATION;
+  options->expand_threshold = DEFAULT_EXPAND_THRESHOLD;
+  options->max_nodes = DEFAULT_MAX_NODES;
+  options->threads = DEFAULT_THREADS;
+  options->mode = DEFAULT_MODE;
+  options->leaf_batch = DEFAULT_LEAF_BATCH;
+  options->seed = 0;
+}
+
+mcts_t
+mcts_new (hex_t hex, const mcts_options_t * options)
+{
+  mcts_t mcts;
+  size_t size = hex_size (hex);
+  size_t words;
+  size_t k;
+  uint i, j;
+  uint t;
+  mcts = g_malloc (sizeof(struct mcts_s));
+  mcts->options = *options;
+  /* The pool is indexed with gint, which is what the atomic
+     operations of GLib work with. */
+  if (mcts->options.max_nodes < 1)
+    mcts->options.max_nodes = 1;
+  if (mcts->options.max_nodes > G_MAXINT)
+    mcts->options.max_nodes = G_MAXINT;
+  if (mcts->options.playouts > G_MAXINT)
+    mcts->options.playouts = G_MAXINT;
+  if (mcts->options.threads < 1)
+    mcts->options.threads = 1;
+  if (mcts->options.leaf_batch < 1)
+    mcts->options.leaf_batch = 1;
+  mcts->size = size;
+  mcts->layout = bitboard_layout_new (size);
+  mcts->words = words = bitboard_layout_words (mcts->layout);
+  mcts->stones[0] = g_malloc0 (4 * words * sizeof(guint64));
+  mcts->stones[1] = mcts->stones[0] + words;
+  mcts->leaf_stones[0] = mcts->stones[0] + 2*words;
+  mcts->leaf_stones[1] = mcts->stones[0] + 3*words;
+  for (j=0; j<size; j++)
+    {
+      for (i=0; i<size; i++)
+        {
+          int player = hex_cell_player (hex, i, j);
+          if (player != 0)
+            BITBOARD_SET (mcts->stones[player-1], j*size + i);
+        }
+    }
+  mcts->player = hex_get_player (hex);
+  /* The pool is split evenly among the trees. */
+  mcts->nodes = g_malloc (mcts->options.max_nodes * sizeof(struct mcts_node_s));
+  if (mcts->options.mode == MCTS_ROOT_PARALLEL)
+    mcts->ntrees = MIN (mcts->options.threads, mcts->options.max_nodes);
+  else
+    mcts->ntrees = 1;
+  mcts->trees = g_new (struct mcts_tree_s, mcts->ntrees);
+  for (t=0; t<mcts->ntrees; t++)
+    {
+      struct mcts_tree_s * tree = &mcts->trees[t];
+      tree->max_nodes = mcts->options.max_nodes / mcts->ntrees;
+      tree->nodes = mcts->nodes + t * tree->max_nodes;
+      tree->nodes_used = 1;
+      memset (&tree->nodes[0], 0, sizeof(struct mcts_node_s));
+    }
+  mcts->inv_sqrt = g_malloc (INV_SQRT_TABLE_SIZE * sizeof(float));
+  mcts->inv_sqrt[0] = 0;
+  for (k=1; k<INV_SQRT_TABLE_SIZE; k++)
+    mcts->inv_sqrt[k] = 1 / sqrt (k);
+  mcts->workers = g_new (struct mcts_worker_s, mcts->options.threads);
+  for (t=0; t<mcts->options.threads; t++)
+    {
+      struct mcts_worker_s * worker = &mcts->workers[t];
+      worker->mcts = mcts;
+      worker->tree = &mcts->trees[t % mcts->ntrees];
+      worker->thread = NULL;
+      worker->scratch[0] = g_malloc0 (2 * words * sizeof(guint64));
+      worker->scratch[1] = worker->scratch[0] + words;
+      /* A path visits each cell at most once, plus the root. */
+      worker->path = g_malloc ((size*size + 1) * sizeof(guint32));
+      worker->empty = g_malloc (size*size * sizeof(guint32));
+      /* The state of xorshift must not be zero. */
+      worker->random = (options->seed + t) * G_GUINT64_CONSTANT(0x9e3779b97f4a7c15) + 1;
+      worker->playouts = 0;
+    }
+  mcts->claimed = 0;
+  mcts->stop = 0;
+  mcts->cancelled = 0;
+  mcts->start = 0;
+  g_mutex_init (&mcts->leaf_lock);
+  g_cond_init (&mcts->leaf_cond);
+  mcts->leaf_generation = 0;
+  mcts->leaf_pending = 0;
+  mcts->playouts = 0;
+  mcts->seconds = 0;
+  return mcts;
+}
+
+void
+mcts_free (mcts_t mcts)
+{
+  uint t;
+  for (t=0; t<mcts->options.threads; t++)
+    {
+      g_free (mcts->workers[t].scratch[0]);
+      g_free (mcts->workers[t].path);
+      g_free (mcts->workers[t].empty);
+    }
+  g_free (mcts->workers);
+  g_mutex_clear (&mcts->leaf_lock);
+  g_cond_clear (&mcts->leaf_cond);
+  g_free (mcts->stones[0]);
+  bitboard_layout_free (mcts->layout);
+  g_free (mcts->trees);
+  g_free (mcts->nodes);
+  g_free (mcts->inv_sqrt);
+  g_free (mcts);
+}
+
+
+/* Searching */
+
+/* Store in WORKER->empty the cells which are not in STONES1 nor in
+   STONES2. Return the number of them. */
+static size_t
+collect_empty (struct mcts_worker_s * worker,
+               const guint64 * stones1, const guint64 * stones2)
+{
+  mcts_t mcts = worker->mcts;
+  const guint64 * board = bitboard_layout_board (mcts->layout);
+  size_t words = mcts->words;
+  size_t n = 0;
+  size_t w;
+  for (w=0; w<words; w++)
+    {
+      guint64 x = board[w] & ~(stones1[w] | stones2[w]);
+      while (x)
+        {
+          worker->empty[n++] = w*64 + lowest_bit (x);
+          x &= x - 1;
+        }
+    }
+  return n;
+}
+
+/* Fill the empty cells of the position in WORKER->scratch at random,
+   starting with PLAYER, and return the winner. */
+static int
+playout (struct mcts_worker_s * worker, int player)
+{
+  bitboard_layout_t layout = worker->mcts->layout;
+  bitboard_t stones1 = worker->scratch[0];
+  bitboard_t stones2 = worker->scratch[1];
+  guint32 * empty = worker->empty;
+  size_t n = collect_empty (worker, stones1, stones2);
+  size_t n1;
+  size_t k;
+  /* Filling the board alternating players gives half of the empty cells
+     (rounded up for PLAYER) to each player. Only the cells of the first
+     player matter, so they are picked as a random subset with a partial
+     Fisher-Yates shuffle. */
+  n1 = (player == 1) ? (n+1)/2 : n/2;
+  for (k=0; k<n1; k++)
+    {
+      guint32 r = k + random_below (worker, n - k);
+      guint32 tmp = empty[r];
+      empty[r] = empty[k];
+      empty[k] = tmp;
+      BITBOARD_SET (stones1, tmp);
+    }
+  /* The first player wins if its stones connect the first and the
+     last rows. The second bitboard is not needed anymore. */
+  bitboard_copy (layout, stones2, bitboard_layout_edge (layout, BITBOARD_FIRST_ROW));
+  bitboard_and (layout, stones2, stones1);
+  bitboard_flood (layout, stones2, stones1);
+  if (bitboard_intersect_p (layout, stones2, bitboard_layout_edge (layout, BITBOARD_LAST_ROW)))
+    return 1;
+  else
+    return 2;
+}
+
+/* Return the index of the child of NODE with the highest UCT value.
+   NODE must be a node of NODES, expanded and with some children. */
+static guint32
+select_child (mcts_t mcts, struct mcts_node_s * nodes, struct mcts_node_s * node)
+{
+  struct mcts_node_s * children = &nodes[node->first_child];
+  gint visits = g_atomic_int_get (&node->visits);
+  double c = mcts->options.exploration * sqrt (log (visits + 1));
+  double best_value = -1;
+  guint32 best = 0;
+  guint32 t;
+  for (t=0; t<node->children; t++)
+    {
+      struct mcts_node_s * child = &children[t];
+      gint child_visits = g_atomic_int_get (&child->visits);
+      gint child_wins = g_atomic_int_get (&child->wins);
+      double inv_sqrt;
+      double value;
+      if (child_visits == 0)
+        return node->first_child + t;
+      if (child_visits < INV_SQRT_TABLE_SIZE)
+        inv_sqrt = mcts->inv_sqrt[child_visits];
+      else
+        inv_sqrt = 1 / sqrt (child_visits);
+      value = inv_sqrt * (child_wins * inv_sqrt + c);
+      if (value > best_value)
+        {
+          best_value = value;
+          best = t;
+        }
+    }
+  return node->first_child + best;
+}
+
+/* Reserve N consecutive nodes of the pool of TREE. Return the index of
+   the first one, or -1 if the pool is full. */
+static gint
+reserve_nodes (struct mcts_tree_s * tree, size_t n)
+{
+  gint used;
+  do
+    {
+      used = g_atomic_int_get (&tree->nodes_used);
+      if (used + n > tree->max_nodes)
+        return -1;
+    }
+  while (!g_atomic_int_compare_and_exchange (&tree->nodes_used, used, used + n));
+  return used;
+}
+
+/* Add the empty cells of the position in WORKER->scratch as children
+   of NODE. The calling thread must have changed the state of NODE to
+   NODE_EXPANDING. If the pool is full or the board too, NODE is
+   published with no children and it stays a leaf forever. */
+static void
+expand (struct mcts_worker_s * worker, struct mcts_node_s * node)
+{
+  struct mcts_tree_s * tree = worker->tree;
+  size_t n = collect_empty (worker, worker->scratch[0], worker->scratch[1]);
+  gint first = (n == 0) ? -1 : reserve_nodes (tree, n);
+  size_t t;
+  if (first < 0)
+    {
+      node->children = 0;
+    }
+  else
+    {
+      for (t=0; t<n; t++)
+        {
+          struct mcts_node_s * child = &tree->nodes[first + t];
+          child->first_child = 0;
+          child->children = 0;
+          child->move = worker->empty[t];
+          child->state = NODE_LEAF;
+          child->visits = 0;
+          child->wins = 0;
+        }
+      node->first_child = first;
+      node->children = n;
+    }
+  /* The atomic store orders the writes above before the new state. */
+  g_atomic_int_set (&node->state, NODE_EXPANDED);
+}
+
+/* Select a path from the root of the tree of WORKER to a leaf,
+   expanding it if it has been visited enough, and leave the position
+   of the leaf in WORKER->scratch. A visit is counted in every node of
+   the path. Return the length of the path and store the player to
+   move at the leaf in PLAYER. */
+static size_t
+descend (struct mcts_worker_s * worker, int * player)
+{
+  mcts_t mcts = worker->mcts;
+  struct mcts_node_s * nodes = worker->tree->nodes;
+  guint32 * path = worker->path;
+  size_t length = 0;
+  guint32 current = 0;
+  *player = mcts->player;
+  bitboard_copy (mcts->layout, worker->scratch[0], mcts->stones[0]);
+  bitboard_copy (mcts->layout, worker->scratch[1], mcts->stones[1]);
+  g_atomic_int_inc (&nodes[current].visits);
+  path[length++] = current;
+  for (;;)
+    {
+      struct mcts_node_s * node = &nodes[current];
+      gint state = g_atomic_int_get (&node->state);
+      if (state == NODE_EXPANDING)
+        break;
+      if (state == NODE_LEAF)
+        {
+          /* The visit of this iteration is already counted. */
+          if (g_atomic_int_get (&node->visits) <= (gint)mcts->options.expand_threshold)
+            break;
+          if (!g_atomic_int_compare_and_exchange (&node->state, NODE_LEAF, NODE_EXPANDING))
+            break;
+          expand (worker, node);
+        }
+      if (node->children == 0)
+        break;
+      current = select_child (mcts, nodes, node);
+      g_atomic_int_inc (&nodes[current].visits);
+      BITBOARD_SET (worker->scratch[*player-1], nodes[current].move);
+      *player = OTHER_PLAYER (*player);
+      path[length++] = current;
+    }
+  return length;
+}
+
+/* Update the statistics of the LENGTH nodes of the path of WORKER
+   with the result of PLAYOUTS playouts, WINS1 of which were won by
+   the first player. One visit per node was counted by descend. */
+static void
+backpropagate (struct mcts_worker_s * worker, size_t length, gint playouts, gint wins1)
+{
+  struct mcts_node_s * nodes = worker->tree->nodes;
+  /* The root was reached by a move of the other player. */
+  int player = OTHER_PLAYER (worker->mcts->player);
+  size_t t;
+  for (t=0; t<length; t++)
+    {
+      struct mcts_node_s * node = &nodes[worker->path[t]];
+      gint wins = (player == 1) ? wins1 : playouts - wins1;
+      if (playouts > 1)
+        g_atomic_int_add (&node->visits, playouts - 1);
+      if (wins > 0)
+        g_atomic_int_add (&node->wins, wins);
+      player = OTHER_PLAYER (player);
+    }
+}
+
+/* Run an iteration: select a path from the root, expand its leaf,
+   do a playout and update the statistics along the path. */
+static void
+iteration (struct mcts_worker_s * worker)
+{
+  int player;
+  size_t length = descend (worker, &player);
+  int winner = playout (worker, player);
+  backpropagate (worker, length, 1, winner == 1);
+}
+
+/* Claim up to N playouts of the budget of the search. Return how many
+   of them should be run, which is zero if the budget is exhausted. */
+static gint
+claim_playouts (mcts_t mcts, gint n)
+{
+  gint limit = mcts->options.playouts;
+  gint claimed;
+  if (limit == 0)
+    return n;
+  do
+    {
+      claimed = g_atomic_int_get (&mcts->claimed);
+      n = MIN (n, limit - claimed);
+      if (n <= 0)
+        return 0;
+    }
+  while (!g_atomic_int_compare_and_exchange (&mcts->claimed, claimed, claimed + n));
+  return n;
+}
+
+/* Return TRUE if the time given to the search is over. */
+static boolean
+timeout_p (mcts_t mcts)
+{
+  double seconds = mcts->options.seconds;
+  return seconds > 0 && g_get_monotonic_time () - mcts->start >= seconds * 1e6;
+}
+
+/* Run iterations in WORKER until the search is stopped or the budget
+   is exhausted. This is the loop of the threads in the tree-parallel
+   and root-parallel modes. */
+static gpointer
+worker_run (gpointer data)
+{
+  struct mcts_worker_s * worker = data;
+  mcts_t mcts = worker->mcts;
+  gint n;
+  while (!g_atomic_int_get (&mcts->stop) && !g_atomic_int_get (&mcts->cancelled)
+         && (n = claim_playouts (mcts, CLAIM_BATCH)) > 0)
+    {
+      while (n-- > 0)
+        {
+          if (worker->playouts % CLOCK_CHECK_INTERVAL == 0 && timeout_p (mcts))
+            {
+              g_atomic_int_set (&mcts->stop, TRUE);
+              break;
+            }
+          iteration (worker);
+          worker->playouts++;
+        }
+    }
+  return NULL;
+}
+
+/* Run the share of WORKER of the playouts of the current leaf, and
+   add the wins of the first player to MCTS->leaf_wins. */
+static void
+leaf_playouts (struct mcts_worker_s * worker)
+{
+  mcts_t mcts = worker->mcts;
+  uint threads = mcts->options.threads;
+  uint index = worker - mcts->workers;
+  gint n = mcts->leaf_playouts / threads + (index < mcts->leaf_playouts % threads);
+  gint wins1 = 0;
+  gint k;
+  for (k=0; k<n; k++)
+    {
+      bitboard_copy (mcts->layout, worker->scratch[0], mcts->leaf_stones[0]);
+      bitboard_copy (mcts->layout, worker->scratch[1], mcts->leaf_stones[1]);
+      if (playout (worker, mcts->leaf_player) == 1)
+        wins1++;
+    }
+  worker->playouts += n;
+  g_atomic_int_add (&mcts->leaf_wins, wins1);
+}
+
+/* Wait for leaves announced by the calling thread and run playouts
+   from them until the search is stopped. This is the loop of the
+   threads but the first one in the leaf-parallel mode. */
+static gpointer
+leaf_worker_run (gpointer data)
+{
+  struct mcts_worker_s * worker = data;
+  mcts_t mcts = worker->mcts;
+  gint generation = 0;
+  for (;;)
+    {
+      g_mutex_lock (&mcts->leaf_lock);
+      while (mcts->leaf_generation == generation && !mcts->stop)
+        g_cond_wait (&mcts->leaf_cond, &mcts->leaf_lock);
+      generation = mcts->leaf_generation;
+      if (mcts->stop)
+        {
+          g_mutex_unlock (&mcts->leaf_lock);
+          break;
+        }
+      g_mutex_unlock (&mcts->leaf_lock);
+      leaf_playouts (worker);
+      g_mutex_lock (&mcts->leaf_lock);
+      if (--mcts->leaf_pending == 0)
+        g_cond_broadcast (&mcts->leaf_cond);
+      g_mutex_unlock (&mcts->leaf_lock);
+    }
+  return NULL;
+}
+
+/* Walk the tree from the first worker, and share the playouts of
+   every leaf among all the threads, until the search is stopped or
+   the budget is exhausted. */
+static void
+leaf_master_run (struct mcts_worker_s * worker)
+{
+  mcts_t mcts = worker->mcts;
+  gint n;
+  while (!timeout_p (mcts) && !g_atomic_int_get (&mcts->cancelled)
+         && (n = claim_playouts (mcts, mcts->options.leaf_batch)) > 0)
+    {
+      int player;
+      size_t length = descend (worker, &player);
+      bitboard_copy (mcts->layout, mcts->leaf_stones[0], worker->scratch[0]);
+      bitboard_copy (mcts->layout, mcts->leaf_stones[1], worker->scratch[1]);
+      mcts->leaf_player = player;
+      mcts->leaf_playouts = n;
+      mcts->leaf_wins = 0;
+      g_mutex_lock (&mcts->leaf_lock);
+      mcts->leaf_pending = mcts->options.threads - 1;
+      mcts->leaf_generation++;
+      g_cond_broadcast (&mcts->leaf_cond);
+      g_mutex_unlock (&mcts->leaf_lock);
+      leaf_playouts (worker);
+      g_mutex_lock (&mcts->leaf_lock);
+      while (mcts->leaf_pending > 0)
+        g_cond_wait (&mcts->leaf_cond, &mcts->leaf_lock);
+      g_mutex_unlock (&mcts->leaf_lock);
+      backpropagate (worker, length, n, g_atomic_int_get (&mcts->leaf_wins));
+    }
+  g_mutex_lock (&mcts->leaf_lock);
+  mcts->stop = TRUE;
+  g_cond_broadcast (&mcts->leaf_cond);
+  g_mutex_unlock (&mcts->leaf_lock);
+}
+
+/* Run iterations until the budget given in the options is
+   exhausted. The first worker runs in the calling thread and the
+   others in new threads. Return the number of playouts done. */
+unsigned long
+mcts_run (mcts_t mcts)
+{
+  GThreadFunc func;
+  unsigned long n = 0;
+  uint t;
+  if (mcts->options.playouts == 0 && mcts->options.seconds <= 0)
+    return 0;
+  if (g_atomic_int_get (&mcts->cancelled))
+    return 0;
+  mcts->claimed = 0;
+  mcts->stop = FALSE;
+  mcts->start = g_get_monotonic_time ();
+  mcts->leaf_generation = 0;
+  if (mcts->options.mode == MCTS_LEAF_PARALLEL)
+    func = leaf_worker_run;
+  else
+    func = worker_run;
+  for (t=0; t<mcts->options.threads; t++)
+    mcts->workers[t].playouts = 0;
+  for (t=1; t<mcts->options.threads; t++)
+    mcts->workers[t].thread = g_thread_new ("mcts", func, &mcts->workers[t]);
+  if (mcts->options.mode == MCTS_LEAF_PARALLEL)
+    leaf_master_run (&mcts->workers[0]);
+  else
+    worker_run (&mcts->workers[0]);
+  for (t=1; t<mcts->options.threads; t++)
+    {
+      g_thread_join (mcts->workers[t].thread);
+      mcts->workers[t].thread = NULL;
+    }
+  for (t=0; t<mcts->options.threads; t++)
+    n += mcts->workers[t].playouts;
+  mcts->playouts += n;
+  mcts->seconds += (g_get_monotonic_time () - mcts->start) / 1e6;
+  return n;
+}
+
+void
+mcts_stop (mcts_t mcts)
+{
+  g_atomic_int_set (&mcts->cancelled, TRUE);
+}
+
+/* The moves of the roots of all the trees are added together. */
+void
+mcts_get_moves (mcts_t mcts, unsigned long * visits, unsigned long * wins)
+{
+  size_t cells = mcts->size * mcts->size;
+  guint32 k;
+  uint t;
+  memset (visits, 0, cells * sizeof(unsigned long));
+  memset (wins, 0, cells * sizeof(unsigned long));
+  for (t=0; t<mcts->ntrees; t++)
+    {
+      struct mcts_node_s * nodes = mcts->trees[t].nodes;
+      struct mcts_node_s * root = &nodes[0];
+      if (root->state != NODE_EXPANDED)
+        continue;
+      for (k=0; k<root->children; k++)
+        {
+          struct mcts_node_s * child = &nodes[root->first_child + k];
+          visits[child->move] += child->visits;
+          wins[child->move] += child->wins;
+        }
+    }
+}
+
+size_t
+mcts_get_pv (mcts_t mcts, uint * pv, size_t max)
+{
+  struct mcts_node_s * nodes = mcts->trees[0].nodes;
+  struct mcts_node_s * node = &nodes[0];
+  size_t length = 0;
+  while (length < max && node->state == NODE_EXPANDED && node->children > 0)
+    {
+      struct mcts_node_s * best = &nodes[node->first_child];
+      guint32 k;
+      for (k=1; k<node->children; k++)
+        {
+          struct mcts_node_s * child = &nodes[node->first_child + k];
+          if (child->visits > best->visits)
+            best = child;
+        }
+      if (best->visits == 0)
+        break;
+      pv[length++] = best->move;
+      node = best;
+    }
+  return length;
+}
+
+/* Store the most visited move of the root and the statistics of the
+   search in RESULT. Return FALSE if no root has been expanded yet. */
+boolean
+mcts_get_result (mcts_t mcts, mcts_result_t * result)
+{
+  size_t cells = mcts->size * mcts->size;
+  unsigned long * visits = g_new (unsigned long, 2 * cells);
+  unsigned long * wins = visits + cells;
+  boolean found = FALSE;
+  guint32 best = 0;
+  guint32 k;
+  uint t;
+  result->playouts = mcts->playouts;
+  result->seconds = mcts->seconds;
+  mcts_get_moves (mcts, visits, wins);
+  for (t=0; t<mcts->ntrees; t++)
+    {
+      struct mcts_node_s * nodes = mcts->trees[t].nodes;
+      struct mcts_node_s * root = &nodes[0];
+      if (root->state != NODE_EXPANDED)
+        continue;
+      for (k=0; k<root->children; k++)
+        {
+          guint32 move = nodes[root->first_child + k].move;
+          if (!found || visits[move] > visits[best])
+            best = move;
+          found = TRUE;
+        }
+    }
+  if (found)
+    {
+      result->i = best % mcts->size;
+      result->j = best / mcts->size;
+      result->winrate = visits[best] ? (double)wins[best] / visits[best] : 0;
+    }
+  g_free (visits);
+  return found;
+}
+
+boolean
+mcts_genmove (hex_t hex, const mcts_options_t * options, uint * i, uint * j)
+{
+  mcts_t mcts;
+  mcts_result_t result;
+  boolean found;
+  if (hex_end_of_game_p (hex))
+    return FALSE;
+  mcts = mcts_new (hex, options);
+  mcts_run (mcts);
+  found = mcts_get_result (mcts, &result);
+  mcts_free (mcts);
+  if (found)
+    {
+      *i = result.i;
+      *j = result.j;
+    }
+  return found;
+}
+
+/* conn-mcts.c ends here */
@@ -0,0 +1,97 @@
+/* conn-mcts.h --- Monte Carlo tree search player (Header) */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef CONN_MCTS_H
+#define CONN_MCTS_H
+
+#include "conn-types.h"
+#include <stdlib.h>
+#include "conn-hex.h"
+
+typedef struct mcts_s * mcts_t;
+
+/* How the threads of a search share the work. */
+typedef enum {
+  MCTS_TREE_PARALLEL,           /* All the threads grow the same tree */
+  MCTS_ROOT_PARALLEL,           /* Each thread grows its own tree */
+  MCTS_LEAF_PARALLEL            /* All the threads run playouts of a leaf */
+} mcts_mode_t;
+
+typedef struct {
+  /* Budget of a search. A zero value means no limit, but at least one
+     of them should be given. */
+  unsigned long playouts;
+  double seconds;
+  /* UCT exploration constant. */
+  double exploration;
+  /* Number of visits of a leaf before it is expanded. */
+  unsigned int expand_threshold;
+  /* Size of the node pool. The tree stops growing when it is full. In
+     the root-parallel mode it is split evenly among the trees. */
+  size_t max_nodes;
+  /* Number of threads which search the tree. */
+  unsigned int threads;
+  mcts_mode_t mode;
+  /* Number of playouts run from each leaf in the leaf-parallel mode. */
+  unsigned int leaf_batch;
+  /* Seed of the random playouts. */
+  unsigned long seed;
+} mcts_options_t;
+
+typedef struct {
+  uint i, j;                    /* Best move */
+  double winrate;               /* Win rate of the best move */
+  unsigned long playouts;       /* Playouts done so far */
+  double seconds;               /* Time spent so far */
+} mcts_result_t;
+
+void mcts_options_init (mcts_options_t * options);
+
+/* Construction and destruction. The search works on a snapshot of the
+   position of HEX, which can be changed or freed afterwards. */
+mcts_t mcts_new (hex_t hex, const mcts_options_t * options);
+void mcts_free (mcts_t mcts);
+
+/* Searching. A search can be run several times, and it goes on
+   growing the same tree. mcts_stop can be called from another thread
+   to stop a running search as soon as possible; afterwards, mcts_run
+   returns at once. */
+unsigned long mcts_run (mcts_t mcts);
+void mcts_stop (mcts_t mcts);
+boolean mcts_get_result (mcts_t mcts, mcts_result_t * result);
+
+/* Store in VISITS and WINS the statistics of each move from the root,
+   as arrays with an element for each cell, in the order (0,0),
+   (1,0)... (size-1,size-1). WINS counts the wins of the player to
+   move. The moves not searched have no visits. */
+void mcts_get_moves (mcts_t mcts, unsigned long * visits, unsigned long * wins);
+
+/* Store in PV the principal variation, up to MAX moves, as the indexes
+   of the cells in the order of mcts_get_moves. It is the sequence of
+   most visited moves from the root of the first tree. Return its
+   length. */
+size_t mcts_get_pv (mcts_t mcts, uint * pv, size_t max);
+
+/* Search the position of HEX and store the best move in I and J.
+   Return FALSE if there is no move to play. */
+boolean mcts_genmove (hex_t hex, const mcts_options_t * options, uint * i, uint * j);
+
+#endif  /* CONN_MCTS_H */
+
+/* conn-mcts.h ends here */
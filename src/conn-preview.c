@@ -0,0 +1,243 @@
+/* conn-preview.c --- Previews of game files */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The files are loaded by a single background thread, one request at
+   a time. Requests are numbered by GENERATION; the thread skips the
+   requests which are not the last one when it gets to them, and after
+   reading the file of a request, it drops it if it has been superseded
+   meanwhile. The result of a request which has been superseded while
+   it was replayed is cached but not delivered.
+
+   The previews are cached in a hash table by file name, modification
+   time to the nanosecond, size and format, so a file rewritten within
+   the same second is loaded again. The least recently used ones are
+   dropped when there are more than PREVIEW_CACHE_SIZE. The cache is
+   only accessed from the main thread. */
+
+#include "config.h"
+#include "utils.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "conn-hex.h"
+#include "conn-preview.h"
+
+#define PREVIEW_CACHE_SIZE 256
+/* Larger files are not previewed, as they can not be cancelled while
+   they are read. */
+#define PREVIEW_MAX_FILE_SIZE (1024 * 1024)
+
+struct cache_entry_s
+{
+  char * key;
+  preview_t * preview;          /* NULL if the file is not a game */
+  GList link;                   /* Link in the LRU queue */
+};
+
+struct job_s
+{
+  char * filename;
+  char * key;
+  hex_format_t format;
+  gint generation;
+  preview_callback_t callback;
+  gpointer user_data;
+  preview_t * preview;
+};
+
+static volatile gint generation = 0;
+static GThreadPool * pool = NULL;
+static GHashTable * cache = NULL;
+/* Cache entries from the most to the least recently used. */
+static GQueue lru = G_QUEUE_INIT;
+
+
+static preview_t *
+preview_new (hex_t hex)
+{
+  preview_t * preview = g_new (preview_t, 1);
+  size_t size = hex_size (hex);
+  size_t i, j;
+  preview->size = size;
+  preview->cells = g_new (guint8, size * size);
+  for (j=0; j<size; j++)
+    for (i=0; i<size; i++)
+      preview->cells[j*size + i] = hex_cell_player (hex, i, j);
+  preview->last_move_p = hex_history_last_move (hex, &preview->last_i, &preview->last_j);
+  return preview;
+}
+
+static void
+preview_free (preview_t * preview)
+{
+  if (preview == NULL)
+    return;
+  g_free (preview->cells);
+  g_free (preview);
+}
+
+static void
+cache_entry_free (gpointer data)
+{
+  struct cache_entry_s * entry = data;
+  g_queue_unlink (&lru, &entry->link);
+  preview_free (entry->preview);
+  g_free (entry->key);
+  g_free (entry);
+}
+
+/* Return the cache key of FILENAME, or NULL if it does not exist. */
+static char *
+cache_key (const char * filename, hex_format_t format)
+{
+  struct stat st;
+  if (stat (filename, &st) != 0)
+    return NULL;
+  return g_strdup_printf ("%s:%ld.%09ld:%ld:%d", filename,
+                          (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec,
+                          (long)st.st_size, format);
+}
+
+static struct cache_entry_s *
+cache_lookup (const char * key)
+{
+  struct cache_entry_s * entry = g_hash_table_lookup (cache, key);
+  if (entry)
+    {
+      g_queue_unlink (&lru, &entry->link);
+      g_queue_push_head_link (&lru, &entry->link);
+    }
+  return entry;
+}
+
+/* Add PREVIEW to the cache under KEY. Both are owned by the cache
+   afterwards. */
+static void
+cache_insert (char * key, preview_t * preview)
+{
+  struct cache_entry_s * entry;
+  g_hash_table_remove (cache, key);
+  entry = g_new (struct cache_entry_s, 1);
+  entry->key = key;
+  entry->preview = preview;
+  entry->link.data = entry;
+  entry->link.prev = entry->link.next = NULL;
+  g_queue_push_head_link (&lru, &entry->link);
+  g_hash_table_insert (cache, key, entry);
+  while (g_hash_table_size (cache) > PREVIEW_CACHE_SIZE)
+    {
+      struct cache_entry_s * oldest = g_queue_peek_tail_link (&lru)->data;
+      g_hash_table_remove (cache, oldest->key);
+    }
+}
+
+/* Deliver the result of JOB in the main loop. */
+static gboolean
+job_done (gpointer data)
+{
+  struct job_s * job = data;
+  cache_insert (job->key, job->preview);
+  if (job->generation == g_atomic_int_get (&generation))
+    job->callback (job->preview, job->user_data);
+  g_free (job->filename);
+  g_free (job);
+  return FALSE;
+}
+
+static void
+job_run (gpointer data, gpointer user_data)
+{
+  struct job_s * job = data;
+  struct stat st;
+  SGFNode * root;
+  hex_t hex = NULL;
+  if (job->generation != g_atomic_int_get (&generation))
+    goto cancelled;
+  if (stat (job->filename, &st) == 0 && st.st_size <= PREVIEW_MAX_FILE_SIZE
+      && (root = readsgffile (job->filename)) != NULL)
+    {
+      /* Reading the file is most of the work, so a request superseded
+         meanwhile is not replayed. */
+      if (job->generation != g_atomic_int_get (&generation))
+        {
+          sgfFreeNode (root);
+          goto cancelled;
+        }
+      hex = hex_load_sgf_tree (job->format, root);
+      sgfFreeNode (root);
+    }
+  if (hex)
+    {
+      job->preview = preview_new (hex);
+      hex_free (hex);
+    }
+  else
+    job->preview = NULL;
+  g_idle_add (job_done, job);
+  return;
+ cancelled:
+  g_free (job->filename);
+  g_free (job->key);
+  g_free (job);
+}
+
+void
+preview_request (const char * filename, hex_format_t format,
+                 preview_callback_t callback, gpointer user_data)
+{
+  struct cache_entry_s * entry;
+  struct job_s * job;
+  char * key;
+  if (cache == NULL)
+    {
+      cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cache_entry_free);
+      pool = g_thread_pool_new (job_run, NULL, 1, FALSE, NULL);
+    }
+  g_atomic_int_inc (&generation);
+  key = cache_key (filename, format);
+  if (key == NULL)
+    {
+      callback (NULL, user_data);
+      return;
+    }
+  entry = cache_lookup (key);
+  if (entry)
+    {
+      g_free (key);
+      callback (entry->preview, user_data);
+      return;
+    }
+  job = g_new (struct job_s, 1);
+  job->filename = g_strdup (filename);
+  job->key = key;
+  job->format = format;
+  job->generation = g_atomic_int_get (&generation);
+  job->callback = callback;
+  job->user_data = user_data;
+  job->preview = NULL;
+  g_thread_pool_push (pool, job, NULL);
+}
+
+void
+preview_cancel (void)
+{
+  g_atomic_int_inc (&generation);
+}
+
+/* conn-preview.c ends here */
@@ -0,0 +1,48 @@
+/* conn-preview.h --- Previews of game files (Header) */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef CONN_PREVIEW_H
+#define CONN_PREVIEW_H
+
+#include <glib.h>
+#include "conn-hex.h"
+
+/* The final position of a game file. */
+typedef struct {
+  size_t size;
+  guint8 * cells;               /* Player of each cell (j*size + i) */
+  boolean last_move_p;
+  uint last_i, last_j;
+} preview_t;
+
+/* PREVIEW is NULL if the file could not be loaded. */
+typedef void (*preview_callback_t) (const preview_t * preview, gpointer user_data);
+
+/* Load the preview of the game in FILENAME, in FORMAT, and call
+   CALLBACK with it from the main loop. Recent previews are cached, and
+   then CALLBACK is called before this returns; otherwise, the file is
+   loaded in another thread. A new request or preview_cancel cancels
+   the previous one, whose callback is not called then. */
+void preview_request (const char * filename, hex_format_t format,
+                      preview_callback_t callback, gpointer user_data);
+void preview_cancel (void);
+
+#endif  /* CONN_PREVIEW_H */
+
+/* conn-preview.h ends here */
@@ -0,0 +1,41 @@
+/* conn-types.h --- Basic types shared by the engine headers (Header) */
+
+/* Copyright (C) 2011 David Vázquez Púa  */
+
+/* This file is part of Connection.
+ *
+ * Connection is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Connection is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Connection.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* This header is installed with the engine library, so it must not
+   define anything private to the program, such as the I18N macros of
+   utils.h. */
+
+#ifndef CONN_TYPES_H
+#define CONN_TYPES_H
+
+#include <stdlib.h>
+
+#ifndef TRUE
+# define TRUE 1
+#endif
+
+#ifndef FALSE
+# define FALSE 0
+#endif
+
+typedef int boolean;
+
+#endif  /* CONN_TYPES_H */
+
+/* conn-types.h ends here */
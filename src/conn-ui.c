@@ -29,6 +29,8 @@
 #include <assert.h>
 #include "conn-hex.h"
 #include "conn-hex-widget.h"
+#include "conn-analysis.h"
+#include "conn-preview.h"
 
 #define DEFAULT_BOARD_SIZE 13
 
@@ -70,8 +72,13 @@ static hex_t game;
 static char * game_file = NULL;  /* Current file game. */
 static hex_format_t game_format; /* The format of the current file game. */
 
+/* The analysis of the position in the widget, if it is enabled. */
+static analysis_t analysis = NULL;
+
 static void hex_to_widget (Hexboard * widget, hex_t hex);
+static void preview_to_widget (const preview_t * preview, gpointer data);
 static void update_hexboard_colors (void);
+static void update_analysis (void);
 static void update_history_buttons (void);
 static void update_hexboard_sensitive (void);
 static void update_window_title(void);
@@ -217,6 +224,16 @@ dialog_selected_format (GtkWidget * dialog)
     abort ();
 }
 
+/* Save the game to game_file, reporting a failure to the user. */
+static void
+save_game (void)
+{
+  if (hex_size (game) > HEX_SGF_MAX_SIZE)
+    g_message (_("Games on boards larger than %d can not be saved."), HEX_SGF_MAX_SIZE);
+  else if (!hex_save_sgf (game, game_format, game_file))
+    g_message (_("The game could not be saved to %s."), game_file);
+}
+
 void
 ui_signal_save_as (GtkMenuItem * item, gpointer data)
 {
@@ -239,7 +256,7 @@ ui_signal_save_as (GtkMenuItem * item, gpointer data)
       game_format = dialog_selected_format (dialog);
       gtk_file_chooser_set_do_overwrite_confirmation (GTK_FILE_CHOOSER (dialog), TRUE);
       if (game_format != HEX_AUTO)
-        hex_save_sgf (game, game_format, game_file);
+        save_game ();
       update_window_title();
     }
   gtk_widget_destroy (dialog);
@@ -249,23 +266,20 @@ void
 ui_signal_open_update_preview (GtkFileChooser *dialog, Hexboard * board)
 {
   gchar * filename; 
-  hex_t game;
   filename = gtk_file_chooser_get_filename (dialog);
   if (filename != NULL)
-    game = hex_load_sgf (game_format, filename);
-  else
-    game = NULL;
-  
-  if (game != NULL)
     {
-      size_t size = hex_size (game);
-      hexboard_set_size (board, size);
-      hex_to_widget (board, game);
-      gtk_widget_set_visible (GTK_WIDGET(board), TRUE);
-      hex_free (game);
+      /* The board is hidden until the preview is loaded, unless it
+         is cached and it is shown right away. */
+      gtk_widget_set_visible (GTK_WIDGET(board), FALSE);
+      preview_request (filename, game_format, preview_to_widget, board);
+      g_free (filename);
     }
   else
-    gtk_widget_set_visible (GTK_WIDGET(board), FALSE);
+    {
+      preview_cancel ();
+      gtk_widget_set_visible (GTK_WIDGET(board), FALSE);
+    }
 }
 
 void
@@ -313,6 +327,7 @@ ui_signal_open (GtkMenuItem * item, gpointer data)
       update_history_buttons();
       check_end_of_game();
     }
+  preview_cancel ();
   gtk_widget_destroy (dialog);
 }
 
@@ -322,7 +337,7 @@ ui_signal_save (GtkMenuItem * item, gpointer data)
   if (game_file == NULL)
     ui_signal_save_as (item, data);
   else
-    hex_save_sgf (game, game_format, game_file);
+    save_game ();
 }
 
 void
@@ -342,11 +357,14 @@ ui_signal_cell_clicked (GtkWidget * widget, gint i, gint j, hex_t ignore)
       double r = hexboard_color[player][0];
       double g = hexboard_color[player][1];
       double b = hexboard_color[player][2];
+      hexboard_begin_update (HEXBOARD(widget));
       if (!first_move_p)
         hexboard_cell_set_border (HEXBOARD(widget), old_i, old_j, CELL_NORMAL_BORDER_WIDTH);
       hexboard_cell_set_color (HEXBOARD(widget), i, j, r, g, b);
       hexboard_cell_set_border (HEXBOARD(widget), i, j, CELL_SELECT_BORDER_WIDTH);
+      hexboard_commit_update (HEXBOARD(widget));
       check_end_of_game();
+      update_analysis();
     }
   else
     gdk_beep();
@@ -357,23 +375,61 @@ static void
 hex_to_widget (Hexboard * widget, hex_t hex)
 {
   size_t size = hex_size (hex);
+  float * colors = g_new (float, 4 * size * size);
+  float * borders = colors + 3 * size * size;
   boolean first_move_p;
-  int i, j;
+  int i, j, k;
   for (j=0; j<size; j++)
     {
       for (i=0; i<size; i++)
         {
           int player = hex_cell_player (hex, i, j);
-          double r = hexboard_color[player][0];
-          double g = hexboard_color[player][1];
-          double b = hexboard_color[player][2];
-          hexboard_cell_set_border (widget, i, j, CELL_NORMAL_BORDER_WIDTH);
-          hexboard_cell_set_color (widget, i, j, r, g, b);
+          k = j*size + i;
+          colors[3*k+0] = hexboard_color[player][0];
+          colors[3*k+1] = hexboard_color[player][1];
+          colors[3*k+2] = hexboard_color[player][2];
+          borders[k] = CELL_NORMAL_BORDER_WIDTH;
         }
     }
   first_move_p = !hex_history_last_move (hex, &i, &j);
   if (!first_move_p)
-    hexboard_cell_set_border (widget, i, j, CELL_SELECT_BORDER_WIDTH);
+    borders[j*size + i] = CELL_SELECT_BORDER_WIDTH;
+  hexboard_set_cells (widget, colors, borders);
+  g_free (colors);
+}
+
+/* Show PREVIEW in the Hexboard widget DATA, or hide it if PREVIEW is
+   NULL. */
+static void
+preview_to_widget (const preview_t * preview, gpointer data)
+{
+  Hexboard * widget = HEXBOARD (data);
+  size_t size;
+  float * colors;
+  float * borders;
+  size_t k;
+  if (preview == NULL)
+    {
+      gtk_widget_set_visible (GTK_WIDGET(widget), FALSE);
+      return;
+    }
+  size = preview->size;
+  colors = g_new (float, 4 * size * size);
+  borders = colors + 3 * size * size;
+  for (k=0; k<size*size; k++)
+    {
+      int player = preview->cells[k];
+      colors[3*k+0] = hexboard_color[player][0];
+      colors[3*k+1] = hexboard_color[player][1];
+      colors[3*k+2] = hexboard_color[player][2];
+      borders[k] = CELL_NORMAL_BORDER_WIDTH;
+    }
+  if (preview->last_move_p)
+    borders[preview->last_j*size + preview->last_i] = CELL_SELECT_BORDER_WIDTH;
+  hexboard_set_size (widget, size);
+  hexboard_set_cells (widget, colors, borders);
+  g_free (colors);
+  gtk_widget_set_visible (GTK_WIDGET(widget), TRUE);
 }
 
 /* Update the color of each cell of the Hexboard widget in screen,
@@ -382,6 +438,48 @@ static void
 update_hexboard_colors (void)
 {
   hex_to_widget (HEXBOARD(hexboard), game);
+  update_analysis ();
+}
+
+/* Show a report of the analysis as an overlay of the win rates on the
+   board and a message in the status bar. */
+static void
+analysis_report (const analysis_report_t * report, gpointer data)
+{
+  GtkStatusbar * statusbar = GTK_STATUSBAR (GET_OBJECT ("statusbar"));
+  guint context = gtk_statusbar_get_context_id (statusbar, "Analysis");
+  char message[256];
+  size_t length;
+  size_t k;
+  hexboard_set_overlay (HEXBOARD(hexboard), report->winrates, TRUE);
+  length = snprintf (message, sizeof(message),
+                     _("Best move %c%u (%.1f%%), %lu playouts (%.0f/s), PV:"),
+                     'a' + report->i, report->j + 1, report->winrate * 100,
+                     report->playouts, report->playouts_per_second);
+  for (k=0; k<report->pv_length && length < sizeof(message); k++)
+    length += snprintf (message + length, sizeof(message) - length, " %c%u",
+                        'a' + (int)(report->pv[k] % report->size),
+                        (uint)(report->pv[k] / report->size) + 1);
+  gtk_statusbar_pop (statusbar, context);
+  gtk_statusbar_push (statusbar, context, message);
+}
+
+/* Restart the analysis on the position in the widget, as it has
+   changed, if the analysis is enabled. */
+static void
+update_analysis (void)
+{
+  GtkCheckMenuItem * item = GTK_CHECK_MENU_ITEM (GET_OBJECT ("menu-analysis"));
+  GtkStatusbar * statusbar = GTK_STATUSBAR (GET_OBJECT ("statusbar"));
+  if (analysis)
+    {
+      analysis_cancel (analysis);
+      analysis = NULL;
+    }
+  hexboard_set_overlay (HEXBOARD(hexboard), NULL, FALSE);
+  gtk_statusbar_pop (statusbar, gtk_statusbar_get_context_id (statusbar, "Analysis"));
+  if (gtk_check_menu_item_get_active (item))
+    analysis = analysis_start (game, analysis_report, NULL);
 }
 
 /* Update the sensitive of history buttons according to the history
@@ -544,6 +642,12 @@ ui_signal_redo (GtkMenuItem * item, gpointer data)
   check_end_of_game();
 }
 
+void
+ui_signal_analysis (GtkCheckMenuItem * item, gpointer data)
+{
+  update_analysis();
+}
+
 void
 ui_signal_preferences (GtkMenuItem * item, gpointer data)
 {
@@ -655,6 +759,8 @@ ui_run (void)
   update_history_buttons();
   update_window_title();
   gtk_main();
+  if (analysis)
+    analysis_cancel (analysis);
   hex_free (game);
 }
 
@@ -37,10 +37,12 @@ int
 get_moveX(SGFProperty *property, int boardsize)
 {
   int i;
-  if (strlen(property->value) < 2)
+  char move[3];
+
+  if (sgfPropertyText(property, move, sizeof(move)) < 2)
     return -1;
 
-  i = toupper((int) property->value[1]) - 'A';
+  i = toupper((int) move[1]) - 'A';
   if (i >= boardsize)
     return -1;
 
@@ -55,10 +57,12 @@ int
 get_moveY(SGFProperty *property, int boardsize)
 {
   int j;
-  if (strlen(property->value) < 2)
+  char move[3];
+
+  if (sgfPropertyText(property, move, sizeof(move)) < 2)
     return -1;
 
-  j = toupper((int) property->value[0]) - 'A';
+  j = toupper((int) move[0]) - 'A';
   if (j >= boardsize)
     return -1;
 
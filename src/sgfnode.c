@@ -31,7 +31,15 @@
 #include <ctype.h>
 #include <setjmp.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #if TIME_WITH_SYS_TIME
 # include <sys/time.h>
@@ -87,40 +95,190 @@ xrealloc(void *pt, unsigned int size)
 }
 
 
+/* ================================================================ */
+/*                        Memory of the trees                       */
+/* ================================================================ */
+
+
+/*
+ * The nodes and properties of a tree are carved out of a few large
+ * blocks owned by the tree instead of being allocated one by one, so
+ * reading or freeing a tree takes a handful of calls to malloc and
+ * free. The values of the properties made with sgfAddProperty and the
+ * like are copied there too, while those read by the parser stay in
+ * the input, which the arena keeps when it owns it. The arena itself
+ * lives at the start of its first block.
+ */
+
+#define ARENA_FIRST_BLOCK 4096
+#define ARENA_MAX_BLOCK   65536
+#define ARENA_ROUND(n)    (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+typedef struct SGFArenaBlock_t {
+  struct SGFArenaBlock_t *next;
+} SGFArenaBlock;
+
+#define BLOCK_DATA(block) ((char *) (block) + ARENA_ROUND(sizeof(SGFArenaBlock)))
+
+struct SGFArena_t {
+  SGFArenaBlock *blocks;        /* The current block first */
+  char *p;                      /* Free space of the current block */
+  char *end;
+  size_t block_size;            /* Size of the current block */
+  SGFNode *root;                /* The node the tree is freed with */
+  void *source;                 /* Input owned by the tree, or NULL */
+  size_t source_length;
+  int source_mapped;            /* SOURCE is mapped, not allocated */
+};
+
+
+static SGFArenaBlock *
+arena_new_block(size_t size)
+{
+  SGFArenaBlock *block = malloc(size);
+
+  if (!block) {
+    fprintf(stderr, "arena_new_block: Out of memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  block->next = NULL;
+  return block;
+}
+
+
+static SGFArena *
+arena_new(void)
+{
+  SGFArenaBlock *block = arena_new_block(ARENA_FIRST_BLOCK);
+  SGFArena *arena = (SGFArena *) BLOCK_DATA(block);
+
+  arena->blocks = block;
+  arena->p = BLOCK_DATA(block) + ARENA_ROUND(sizeof(SGFArena));
+  arena->end = (char *) block + ARENA_FIRST_BLOCK;
+  arena->block_size = ARENA_FIRST_BLOCK;
+  arena->root = NULL;
+  arena->source = NULL;
+  arena->source_length = 0;
+  arena->source_mapped = 0;
+  return arena;
+}
+
+
+/*
+ * Allocate SIZE bytes from ARENA. The blocks double in size up to
+ * ARENA_MAX_BLOCK; larger requests get a block of their own, which
+ * leaves the free space of the current one for later.
+ */
+
+static void *
+arena_alloc(SGFArena *arena, size_t size)
+{
+  void *pt;
+
+  size = ARENA_ROUND(size);
+  if (size > (size_t) (arena->end - arena->p)) {
+    size_t header = ARENA_ROUND(sizeof(SGFArenaBlock));
+    SGFArenaBlock *block;
+
+    if (size > ARENA_MAX_BLOCK / 4) {
+      block = arena_new_block(header + size);
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+      return BLOCK_DATA(block);
+    }
+
+    if (arena->block_size < ARENA_MAX_BLOCK)
+      arena->block_size *= 2;
+    while (arena->block_size - header < size)
+      arena->block_size *= 2;
+    block = arena_new_block(arena->block_size);
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->p = BLOCK_DATA(block);
+    arena->end = (char *) block + arena->block_size;
+  }
+
+  pt = arena->p;
+  arena->p += size;
+  return pt;
+}
+
+
+static void
+arena_free(SGFArena *arena)
+{
+  SGFArenaBlock *block = arena->blocks;
+
+#ifdef HAVE_MMAP
+  if (arena->source_mapped)
+    munmap(arena->source, arena->source_length);
+  else
+#endif
+    free(arena->source);
+
+  /*
+   * The list starts at the block being filled, each one followed by
+   * the dedicated blocks of large requests made while it was current
+   * and then by the block filled before it. The arena lives in the
+   * first block allocated, which may be followed by dedicated blocks,
+   * so it is only read before the loop, and the next block is taken
+   * before each block is freed.
+   */
+  while (block) {
+    SGFArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+
 /* ================================================================ */
 /*                           SGF Nodes                              */
 /* ================================================================ */
 
 
 /*
- * Allocate memory for a new SGF node.
+ * Allocate a node of the tree whose memory is ARENA.
  */
 
-SGFNode *
-sgfNewNode()
+static SGFNode *
+arena_new_node(SGFArena *arena)
 {
-  SGFNode *newnode;
-  newnode = xalloc(sizeof(SGFNode));
+  SGFNode *newnode = arena_alloc(arena, sizeof(SGFNode));
   newnode->next = NULL;
   newnode->props = NULL;
   newnode->parent = NULL;
   newnode->child = NULL;
+  newnode->arena = arena;
+  newnode->index = NULL;
+  newnode->mask = 0;
+  newnode->nprops = 0;
   return newnode;
 }
 
+
 /*
- * Recursively free an sgf node
+ * Allocate memory for a new SGF node, the root of a new tree.
+ */
+
+SGFNode *
+sgfNewNode()
+{
+  SGFArena *arena = arena_new();
+  arena->root = arena_new_node(arena);
+  return arena->root;
+}
+
+/*
+ * Free an sgf tree. The other nodes are freed with their root.
  */
 
 void
 sgfFreeNode(SGFNode *node)
 {
-  if (node == NULL)
+  if (node == NULL || node->arena->root != node)
     return;
-  sgfFreeNode(node->next);
-  sgfFreeNode(node->child);
-  sgfFreeProperty(node->props);
-  free(node);
+  arena_free(node->arena);
 }
 
 
@@ -169,6 +327,113 @@ sgfAddPropertyFloat(SGFNode *node, const char *name, float val)
 }
 
 
+/*
+ * Property lookup. The mask of a node has the bit PROPERTY_BIT of the
+ * name of each of its properties, so most lookups of a property that
+ * is not there end without reading the list. A node with at least
+ * INDEX_MIN_PROPS properties also gets an index, the first property
+ * of each name sorted by name, the first time one is looked up. It is
+ * dropped when a property is added.
+ */
+
+#define PROPERTY_BIT(name) \
+  (1u << ((((unsigned short) (name)) * 40503u >> 11) & 31))
+#define INDEX_MIN_PROPS 6
+
+typedef struct SGFIndexEntry_t {
+  short name;
+  SGFProperty *prop;
+} SGFIndexEntry;
+
+struct SGFIndex_t {
+  unsigned int size;
+  SGFIndexEntry entries[1];     /* SIZE entries in fact */
+};
+
+
+static void
+build_index(SGFNode *node)
+{
+  SGFIndex *index;
+  SGFProperty *prop;
+
+  index = arena_alloc(node->arena, sizeof(SGFIndex)
+		      + (node->nprops - 1) * sizeof(SGFIndexEntry));
+  index->size = 0;
+  for (prop = node->props; prop; prop = prop->next) {
+    unsigned int k = index->size;
+
+    while (k > 0 && index->entries[k-1].name > prop->name)
+      k--;
+    if (k > 0 && index->entries[k-1].name == prop->name)
+      continue;
+    memmove(&index->entries[k+1], &index->entries[k],
+	    (index->size - k) * sizeof(SGFIndexEntry));
+    index->entries[k].name = prop->name;
+    index->entries[k].prop = prop;
+    index->size++;
+  }
+  node->index = index;
+}
+
+
+/*
+ * The first property of NODE called NAME, or NULL.
+ */
+
+static SGFProperty *
+find_property(SGFNode *node, short name)
+{
+  SGFProperty *prop;
+
+  if (!(node->mask & PROPERTY_BIT(name)))
+    return NULL;
+
+  if (node->nprops >= INDEX_MIN_PROPS) {
+    unsigned int low = 0;
+    unsigned int high;
+
+    if (!node->index)
+      build_index(node);
+    high = node->index->size;
+    while (low < high) {
+      unsigned int middle = (low + high) / 2;
+      if (node->index->entries[middle].name < name)
+	low = middle + 1;
+      else
+	high = middle;
+    }
+    if (low < node->index->size && node->index->entries[low].name == name)
+      return node->index->entries[low].prop;
+    return NULL;
+  }
+
+  for (prop = node->props; prop; prop = prop->next)
+    if (prop->name == name)
+      return prop;
+
+  return NULL;
+}
+
+
+/*
+ * The value of PROP, a property of NODE, as a string. It is made the
+ * first time it is asked for.
+ */
+
+static char *
+property_value(SGFNode *node, SGFProperty *prop)
+{
+  if (!prop->value) {
+    char *value = arena_alloc(node->arena, prop->length + 1);
+    prop->length = sgfPropertyText(prop, value, prop->length + 1);
+    prop->raw = prop->value = value;
+    prop->escaped = 0;
+  }
+  return prop->value;
+}
+
+
 /*
  * Read a property as int from an SGF node.
  */
@@ -176,16 +441,13 @@ sgfAddPropertyFloat(SGFNode *node, const char *name, float val)
 int
 sgfGetIntProperty(SGFNode *node, const char *name, int *value)
 {
-  SGFProperty *prop;
-  short nam = name[0] | name[1] << 8;
+  SGFProperty *prop = find_property(node, name[0] | name[1] << 8);
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (prop->name == nam) {
-      *value = atoi(prop->value);
-      return 1;
-    }
+  if (!prop)
+    return 0;
 
-  return 0;
+  *value = atoi(property_value(node, prop));
+  return 1;
 }
 
 
@@ -196,17 +458,14 @@ sgfGetIntProperty(SGFNode *node, const char *name, int *value)
 int
 sgfGetFloatProperty(SGFNode *node, const char *name, float *value)
 {
-  SGFProperty *prop;
-  short nam = name[0] | name[1] << 8;
+  SGFProperty *prop = find_property(node, name[0] | name[1] << 8);
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (prop->name == nam) {
-      *value = (float) atof(prop->value);
-      /* MS-C warns of loss of data (double to float) */
-      return 1;
-    }
+  if (!prop)
+    return 0;
 
-  return 0;
+  *value = (float) atof(property_value(node, prop));
+  /* MS-C warns of loss of data (double to float) */
+  return 1;
 }
 
 
@@ -217,16 +476,13 @@ sgfGetFloatProperty(SGFNode *node, const char *name, float *value)
 int
 sgfGetCharProperty(SGFNode *node, const char *name, char **value)
 {
-  SGFProperty *prop;
-  short nam = name[0] | name[1] << 8;
+  SGFProperty *prop = find_property(node, name[0] | name[1] << 8);
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (prop->name == nam) {
-      *value = prop->value;
-      return 1;
-    }
+  if (!prop)
+    return 0;
 
-  return 0;
+  *value = property_value(node, prop);
+  return 1;
 }
 
 
@@ -237,14 +493,26 @@ sgfGetCharProperty(SGFNode *node, const char *name, char **value)
 static int
 sgfHasProperty(SGFNode *node, const char *name)
 {
-  SGFProperty *prop;
-  short nam = name[0] | name[1] << 8;
+  return find_property(node, name[0] | name[1] << 8) != NULL;
+}
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (prop->name == nam)
-      return 1;
 
-  return 0;
+/*
+ * Set the value of PROP, a property of NODE, to TEXT. The old value
+ * is reused when it is long enough.
+ */
+
+static void
+set_property_value(SGFNode *node, SGFProperty *prop, const char *text)
+{
+  size_t len = strlen(text);
+
+  if (!prop->value || len > strlen(prop->value))
+    prop->value = arena_alloc(node->arena, len + 1);
+  memcpy(prop->value, text, len + 1);
+  prop->raw = prop->value;
+  prop->length = len;
+  prop->escaped = 0;
 }
 
 
@@ -256,17 +524,12 @@ sgfHasProperty(SGFNode *node, const char *name)
 void
 sgfOverwriteProperty(SGFNode *node, const char *name, const char *text)
 {
-  SGFProperty *prop;
-  short nam = name[0] | name[1] << 8;
-
-  for (prop = node->props; prop; prop = prop->next)
-    if (prop->name == nam) {
-      prop->value = xrealloc(prop->value, strlen(text)+1);
-      strcpy(prop->value, text);
-      return;
-    }
+  SGFProperty *prop = find_property(node, name[0] | name[1] << 8);
 
-  sgfAddProperty(node, name, text);
+  if (prop)
+    set_property_value(node, prop, text);
+  else
+    sgfAddProperty(node, name, text);
 }
 
 
@@ -278,17 +541,16 @@ sgfOverwriteProperty(SGFNode *node, const char *name, const char *text)
 void
 sgfOverwritePropertyInt(SGFNode *node, const char *name, int val)
 {
-  SGFProperty *prop;
-  short nam = name[0] | name[1] << 8;
+  SGFProperty *prop = find_property(node, name[0] | name[1] << 8);
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (prop->name == nam) {
-      prop->value = xrealloc(prop->value, 12);
-      snprintf(prop->value, 12, "%d", val);
-      return;
-   }
+  if (prop) {
+    char buffer[12];
 
-  sgfAddPropertyInt(node, name, val);
+    snprintf(buffer, 12, "%d", val);
+    set_property_value(node, prop, buffer);
+  }
+  else
+    sgfAddPropertyInt(node, name, val);
 }
 
 
@@ -300,17 +562,16 @@ sgfOverwritePropertyInt(SGFNode *node, const char *name, int val)
 void
 sgfOverwritePropertyFloat(SGFNode *node, const char *name, float val)
 {
-  SGFProperty *prop;
-  short nam = name[0] | name[1] << 8;
+  SGFProperty *prop = find_property(node, name[0] | name[1] << 8);
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (prop->name == nam) {
-      prop->value = xrealloc(prop->value, 15);
-      snprintf(prop->value, 15, "%3.1f", val);
-      return;
-    }
+  if (prop) {
+    char buffer[15];
 
-  sgfAddPropertyFloat(node, name, val);
+    snprintf(buffer, 15, "%3.1f", val);
+    set_property_value(node, prop, buffer);
+  }
+  else
+    sgfAddPropertyFloat(node, name, val);
 }
 
 
@@ -358,18 +619,34 @@ sgfRoot(SGFNode *node)
 
 
 /*
- * Make an SGF property.
+ * The code of the property called NAME.
+ */
+static short
+property_name(const char *name)
+{
+  if (strlen(name) == 1)
+    return name[0] | (short) (' ' << 8);
+  else
+    return name[0] | name[1] << 8;
+}
+
+
+/*
+ * Make an SGF property whose value is the LENGTH bytes at RAW, which
+ * are not copied. ESCAPED tells whether they have escapes.
  */
 static SGFProperty *
-do_sgf_make_property(short sgf_name,  const char *value,
-		     SGFNode *node, SGFProperty *last)
+do_sgf_make_slice_property(short sgf_name, const char *raw, size_t length,
+			   int escaped, SGFNode *node, SGFProperty *last)
 {
   SGFProperty *prop;
 
-  prop = (SGFProperty *) xalloc(sizeof(SGFProperty));
+  prop = arena_alloc(node->arena, sizeof(SGFProperty));
   prop->name = sgf_name;
-  prop->value = xalloc(strlen(value) + 1);
-  strcpy(prop->value, value);
+  prop->escaped = escaped;
+  prop->length = length;
+  prop->raw = raw;
+  prop->value = NULL;
   prop->next = NULL;
 
   if (last == NULL)
@@ -377,45 +654,67 @@ do_sgf_make_property(short sgf_name,  const char *value,
   else
     last->next = prop;
 
+  node->mask |= PROPERTY_BIT(sgf_name);
+  node->nprops++;
+  node->index = NULL;
+
   return prop;
 }
 
 
-/* Make an SGF property.  In case of a property with a range it
- * expands it and makes several properties instead.
+/*
+ * Make an SGF property.
  */
-SGFProperty *
-sgfMkProperty(const char *name, const  char *value,
-	      SGFNode *node, SGFProperty *last)
+static SGFProperty *
+do_sgf_make_property(short sgf_name,  const char *value,
+		     SGFNode *node, SGFProperty *last)
+{
+  size_t len = strlen(value);
+  char *copy = arena_alloc(node->arena, len + 1);
+
+  memcpy(copy, value, len + 1);
+  last = do_sgf_make_slice_property(sgf_name, copy, len, 0, node, last);
+  last->value = copy;
+  return last;
+}
+
+
+/*
+ * Can the values of the property SGF_NAME be ranges like aa:cc?
+ */
+static int
+property_allows_ranges(short sgf_name)
 {
-  static const short properties_allowing_ranges[12] = {
+  switch (sgf_name) {
     /* Board setup properties. */
-    SGFAB, SGFAW, SGFAE,
+  case SGFAB: case SGFAW: case SGFAE:
 
     /* Markup properties. */
-    SGFCR, SGFMA, SGFSQ, SGFTR, SGFDD, SGFSL,
+  case SGFCR: case SGFMA: case SGFSQ: case SGFTR: case SGFDD: case SGFSL:
 
     /* Miscellaneous properties. */
-    SGFVW,
+  case SGFVW:
 
     /* Go-specific properties. */
-    SGFTB, SGFTW
-  };
+  case SGFTB: case SGFTW:
+    return 1;
 
-  int k;
-  short sgf_name;
+  default:
+    return 0;
+  }
+}
 
-  if (strlen(name) == 1)
-    sgf_name = name[0] | (short) (' ' << 8);
-  else
-    sgf_name = name[0] | name[1] << 8;
 
-  for (k = 0; k < 12; k++) {
-    if (properties_allowing_ranges[k] == sgf_name)
-      break;
-  }
+/* Make an SGF property.  In case of a property with a range it
+ * expands it and makes several properties instead.
+ */
+SGFProperty *
+sgfMkProperty(const char *name, const  char *value,
+	      SGFNode *node, SGFProperty *last)
+{
+  short sgf_name = property_name(name);
 
-  if (k < 12
+  if (property_allows_ranges(sgf_name)
       && strlen(value) == 5
       && value[2] == ':') {
     char x1 = value[0];
@@ -440,18 +739,87 @@ sgfMkProperty(const char *name, const  char *value,
 
 
 /*
- * Recursively free an SGF property.
- *
+ * Free an SGF property. Nothing to do: the properties belong to the
+ * memory of their tree and are freed with its root.
  */
 
 void
 sgfFreeProperty(SGFProperty *prop)
 {
-  if (prop == NULL)
-    return;
-  sgfFreeProperty(prop->next);
-  free(prop->value);
-  free(prop);
+  (void) prop;
+}
+
+
+/*
+ * Process the escapes of the LENGTH bytes at RAW, the slice of a
+ * value between its brackets, as the FF4 definition of the backslash
+ * says, and remove the trailing whitespace. The result is stored in
+ * BUF as a string of at most SIZE-1 characters and its full length
+ * is returned.
+ */
+static size_t
+unescape_value(const char *raw, size_t length, char *buf, size_t size)
+{
+  const char *end = raw + length;
+  size_t n = 0;
+  size_t trimmed = 0;
+
+  while (raw < end) {
+    int c = *raw++;
+
+    if (c == '\\' && raw < end) {
+      c = *raw++;
+      if (c == '\r' && raw < end) {
+	c = *raw++;
+	if (c == '\n' && raw < end)
+	  c = *raw++;
+      }
+      else if (c == '\n' && raw < end) {
+	c = *raw++;
+	if (c == '\r' && raw < end)
+	  c = *raw++;
+      }
+    }
+    if (n + 1 < size)
+      buf[n] = c;
+    n++;
+    /* The first character is kept even if it is whitespace. */
+    if (n == 1 || !isspace((int) (unsigned char) c))
+      trimmed = n;
+  }
+
+  if (size > 0)
+    buf[trimmed < size ? trimmed : size - 1] = '\0';
+  return trimmed;
+}
+
+
+/*
+ * Store the value of the LENGTH bytes at RAW, with escapes if
+ * ESCAPED, like unescape_value.
+ */
+static size_t
+slice_text(const char *raw, size_t length, int escaped,
+	   char *buf, size_t size)
+{
+  size_t n;
+
+  if (escaped)
+    return unescape_value(raw, length, buf, size);
+  if (size == 0)
+    return length;
+
+  n = length < size ? length : size - 1;
+  memcpy(buf, raw, n);
+  buf[n] = '\0';
+  return length;
+}
+
+
+size_t
+sgfPropertyText(SGFProperty *prop, char *buf, size_t size)
+{
+  return slice_text(prop->raw, prop->length, prop->escaped, buf, size);
 }
 
 
@@ -496,7 +864,7 @@ sgfAddPlay(SGFNode *node, int who, int movex, int movey)
   if (node->child)
     new = sgfStartVariantFirst(node->child);
   else {
-    new = sgfNewNode();
+    new = arena_new_node(node->arena);
     node->child = new;
     new->parent = node;
   }
@@ -710,7 +1078,7 @@ sgfStartVariant(SGFNode *node)
 
   while (node->next)
     node = node->next;
-  node->next = sgfNewNode();
+  node->next = arena_new_node(node->arena);
   node->next->parent = node->parent;
 
   return node->next;
@@ -725,11 +1093,13 @@ SGFNode *
 sgfStartVariantFirst(SGFNode *node)
 {
   SGFNode *old_first_child = node;
-  SGFNode *new_first_child = sgfNewNode();
+  SGFNode *new_first_child;
 
   assert(node);
   assert(node->parent);
 
+  new_first_child = arena_new_node(node->arena);
+
   new_first_child->next = old_first_child;
   new_first_child->parent = old_first_child->parent;
 
@@ -747,9 +1117,11 @@ sgfStartVariantFirst(SGFNode *node)
 SGFNode *
 sgfAddChild(SGFNode *node)
 {
-  SGFNode *new_node = sgfNewNode();
+  SGFNode *new_node;
   assert(node);
 
+  new_node = arena_new_node(node->arena);
+
   new_node->parent = node;
 
   if (!node->child)
@@ -852,7 +1224,7 @@ sgf_write_header(SGFNode *root, int overwrite, int seed, float komi,
 /* ================================================================ */
 
 
-#define MAX_FILE_BUFFER 200000 /* buffer for reading SGF file. */
+#define FILE_BUFFER_CHUNK 65536 /* Growth of the buffer of a file which is not mapped. */
 
 /*
  * SGF grammar:
@@ -874,33 +1246,28 @@ sgf_write_header(SGFNode *root, int overwrite, int seed, float komi,
  *   2) The only recursion is on gametree.
  *   3) Tokens are only one character
  *
- * We will use a global state to keep track of the remaining input
- * and a global char variable, `lookahead' to hold the next token.
- * The function `nexttoken' skips whitespace and fills lookahead with
- * the new token.
+ * The state of a parse is kept in a SGFParser structure, which is
+ * passed to every function of the parser, so several files can be
+ * parsed at once in different threads. The input is a buffer in
+ * memory, scanned by a pointer, and the char `lookahead' holds the
+ * next token. The
+ * function `nexttoken' skips whitespace and fills lookahead with the
+ * new token.
  */
 
 
-static void parse_error(const char *msg, int arg);
-static void nexttoken(void);
-static void match(int expected);
-
-
-static FILE *sgffile;
-
-
-#define sgf_getch() (getc(sgffile))
-
-
-static char *sgferr;
-#ifdef TEST_SGFPARSER
-static int sgferrarg;
-#endif
-static int sgferrpos;
+static void parse_error(SGFParser *parser, const char *msg, int arg);
+static void nexttoken(SGFParser *parser);
+static void match(SGFParser *parser, int expected);
 
-static int lookahead;
 
-static jmp_buf parser_caller;
+static inline int
+sgf_getch(SGFParser *parser)
+{
+  if (parser->p == parser->end)
+    return EOF;
+  return (unsigned char) *parser->p++;
+}
 
 
 /* ---------------------------------------------------------------- */
@@ -908,31 +1275,36 @@ static jmp_buf parser_caller;
 /* ---------------------------------------------------------------- */
 
 
+/* Abort the parse. ARG is 1 if the tree has not been started yet, so
+ * there is nothing to free, and 2 otherwise.
+ */
 static void
-parse_error(const char *msg, int arg)
+parse_error(SGFParser *parser, const char *msg, int arg)
 {
+  parser->error = msg;
+  parser->errpos = parser->p - parser->buffer;
   fprintf(stderr, msg, arg);
   fprintf(stderr, "\n");
-  longjmp (parser_caller, arg);
+  longjmp (parser->caller, arg);
 }
 
 
 static void
-nexttoken()
+nexttoken(SGFParser *parser)
 {
   do
-    lookahead = sgf_getch();
-  while (isspace(lookahead));
+    parser->lookahead = sgf_getch(parser);
+  while (isspace(parser->lookahead));
 }
 
 
 static void
-match(int expected)
+match(SGFParser *parser, int expected)
 {
-  if (lookahead != expected)
-    parse_error("expected: %c", 2);
+  if (parser->lookahead != expected)
+    parse_error(parser, "expected: %c", 2);
   else
-    nexttoken();
+    nexttoken(parser);
 }
 
 /* ---------------------------------------------------------------- */
@@ -941,184 +1313,230 @@ match(int expected)
 
 
 static void
-propident(char *buffer, int size)
+propident(SGFParser *parser, char *buffer, int size)
 {
-  if (lookahead == EOF || !isupper(lookahead))
-    parse_error("Expected an upper case letter.", 2);
+  if (parser->lookahead == EOF || !isupper(parser->lookahead))
+    parse_error(parser, "Expected an upper case letter.", 2);
 
-  while (lookahead != EOF && isalpha(lookahead)) {
-    if (isupper(lookahead) && size > 1) {
-      *buffer++ = lookahead;
+  while (parser->lookahead != EOF && isalpha(parser->lookahead)) {
+    if (isupper(parser->lookahead) && size > 1) {
+      *buffer++ = parser->lookahead;
       size--;
     }
-    nexttoken();
+    nexttoken(parser);
   }
   *buffer = '\0';
 }
 
 
+/* Scan a value and store in *RAW and *LENGTH its slice of the input,
+ * without the brackets. The escapes are left for unescape_value, and
+ * *ESCAPED tells whether there are any; if not, the trailing
+ * whitespace is already out of the slice.
+ */
 static void
-propvalue(char *buffer, int size)
+propvalue(SGFParser *parser, const char **raw, size_t *length, int *escaped)
 {
-  char *p = buffer;
-
-  match('[');
-  while (lookahead != ']' && lookahead != EOF) {
-    if (lookahead == '\\') {
-      lookahead = sgf_getch();
+  const char *start;
+  const char *end;
+
+  match(parser, '[');
+  /* The lookahead is the character just before P. */
+  start = parser->p - 1;
+  *escaped = 0;
+  while (parser->lookahead != ']' && parser->lookahead != EOF) {
+    if (parser->lookahead == '\\') {
+      *escaped = 1;
+      parser->lookahead = sgf_getch(parser);
       /* Follow the FF4 definition of backslash */
-      if (lookahead == '\r') {
-	lookahead = sgf_getch();
-	if (lookahead == '\n')
-	  lookahead = sgf_getch();
+      if (parser->lookahead == '\r') {
+	parser->lookahead = sgf_getch(parser);
+	if (parser->lookahead == '\n')
+	  parser->lookahead = sgf_getch(parser);
       }
-      else if (lookahead == '\n') {
-	lookahead = sgf_getch();
-	if (lookahead == '\r')
-	  lookahead = sgf_getch();
+      else if (parser->lookahead == '\n') {
+	parser->lookahead = sgf_getch(parser);
+	if (parser->lookahead == '\r')
+	  parser->lookahead = sgf_getch(parser);
       }
     }
-    if (size > 1) {
-      *p++ = lookahead;
-      size--;
-    }
-    lookahead = sgf_getch();
+    parser->lookahead = sgf_getch(parser);
   }
-  match(']');
-
-  /* Remove trailing whitespace. The double cast below is needed
-   * because "char" may be represented as a signed char, in which case
-   * characters between 128 and 255 would be negative and a direct
-   * cast to int would cause a negative value to be passed to isspace,
-   * possibly causing an assertion failure.
+  end = parser->p - 1;
+  match(parser, ']');
+
+  /* Remove trailing whitespace, but not the first character. The
+   * double cast below is needed because "char" may be represented as
+   * a signed char, in which case characters between 128 and 255 would
+   * be negative and a direct cast to int would cause a negative value
+   * to be passed to isspace, possibly causing an assertion failure.
    */
-  --p;
-  while (p > buffer && isspace((int) (unsigned char) *p))
-    --p;
-  *++p = '\0';
+  if (!*escaped)
+    while (end - start > 1 && isspace((int) (unsigned char) end[-1]))
+      --end;
+
+  *raw = start;
+  *length = end - start;
 }
 
 
 static SGFProperty *
-property(SGFNode *n, SGFProperty *last)
+property(SGFParser *parser, SGFNode *n, SGFProperty *last)
 {
   char name[3];
-  char buffer[4000];
+  short sgf_name;
+  const char *raw;
+  size_t length;
+  int escaped;
 
-  propident(name, sizeof(name));
+  propident(parser, name, sizeof(name));
+  sgf_name = property_name(name);
   do {
-    propvalue(buffer, sizeof(buffer));
-    last = sgfMkProperty(name, buffer, n, last);
-  } while (lookahead == '[');
+    char range[6];
+
+    propvalue(parser, &raw, &length, &escaped);
+    /* A range, which sgfMkProperty expands, has five characters. */
+    if (property_allows_ranges(sgf_name)
+	&& (length == 5 || (escaped && length > 5))
+	&& slice_text(raw, length, escaped, range, sizeof(range)) == 5
+	&& range[2] == ':')
+      last = sgfMkProperty(name, range, n, last);
+    else
+      last = do_sgf_make_slice_property(sgf_name, raw, length, escaped,
+					n, last);
+  } while (parser->lookahead == '[');
   return last;
 }
 
 
 static void
-node(SGFNode *n)
+node(SGFParser *parser, SGFNode *n)
 {
   SGFProperty *last = NULL;
-  match(';');
-  while (lookahead != EOF && isupper(lookahead))
-    last = property(n, last);
+  match(parser, ';');
+  while (parser->lookahead != EOF && isupper(parser->lookahead))
+    last = property(parser, n, last);
 }
 
 
 static SGFNode *
-sequence(SGFNode *n)
+sequence(SGFParser *parser, SGFNode *n)
 {
-  node(n);
-  while (lookahead == ';') {
-    SGFNode *new = sgfNewNode();
+  node(parser, n);
+  while (parser->lookahead == ';') {
+    SGFNode *new = arena_new_node(n->arena);
     new->parent = n;
     n->child = new;
     n = new;
-    node(n);
+    node(parser, n);
   }
   return n;
 }
 
 
+/*
+ * Parse a game tree into *P. Its variations are game trees too, but
+ * they are parsed in the same loop rather than by recursion: the
+ * heads of the game trees that enclose the current one are kept in
+ * the stack of PARSER, so deep nesting costs heap instead of stack.
+ */
 static void
-gametree(SGFNode **p, SGFNode *parent, int mode)
+gametree(SGFParser *parser, SGFNode **p, int mode)
 {
+  SGFNode *head;
+  SGFNode *last;
+  size_t depth = 0;
+
   if (mode == STRICT_SGF)
-    match('(');
+    match(parser, '(');
   else
     for (;;) {
-      if (lookahead == EOF) {
+      if (parser->lookahead == EOF) {
         /* Don't call sgfFreeNode */
-	parse_error("Empty file?", 1);
+	parse_error(parser, "Empty file?", 1);
 	break;
       }
-      if (lookahead == '(') {
-	while (lookahead == '(')
-	  nexttoken();
-	if (lookahead == ';')
+      if (parser->lookahead == '(') {
+	while (parser->lookahead == '(')
+	  nexttoken(parser);
+	if (parser->lookahead == ';')
 	  break;
       }
-      nexttoken();
+      nexttoken(parser);
     }
 
   /* The head is parsed */
-  {
-    SGFNode *head = sgfNewNode();
-    SGFNode *last;
-
-    head->parent = parent;
-    *p = head;
-
-    last = sequence(head);
-    p = &last->child;
-    while (lookahead == '(') {
-      gametree(p, last, STRICT_SGF);
-      p = &((*p)->next);
+  head = sgfNewNode();
+  *p = head;
+  last = sequence(parser, head);
+  p = &last->child;
+
+  for (;;) {
+    if (parser->lookahead == '(') {
+      /* A variation of LAST. */
+      match(parser, '(');
+      if (depth == parser->stack_size) {
+	parser->stack_size = parser->stack_size ? 2 * parser->stack_size : 64;
+	parser->stack = xrealloc(parser->stack,
+				 parser->stack_size * sizeof(SGFNode *));
+      }
+      parser->stack[depth++] = head;
+
+      head = arena_new_node(last->arena);
+      head->parent = last;
+      *p = head;
+      last = sequence(parser, head);
+      p = &last->child;
+    }
+    else if (depth > 0) {
+      /* The end of a variation; back to the game tree it is in. */
+      match(parser, ')');
+      p = &head->next;
+      last = head->parent;
+      head = parser->stack[--depth];
     }
-    if (mode == STRICT_SGF)
-      match(')');
+    else
+      break;
   }
+
+  if (mode == STRICT_SGF)
+    match(parser, ')');
 }
 
 
 /*
- * Wrapper around readsgf which reads from a file rather than a string.
- * Returns NULL if file will not open, or some other parsing error.
- * Filename "-" means read from stdin, and leave it open when done.
+ * Read a SGF tree from the LEN bytes at BUF with the state PARSER,
+ * which needs no initialization. Returns NULL on a parsing error,
+ * whose message and position are left in PARSER.
  */
 
 SGFNode *
-readsgffile(const char *filename)
+readsgf_ctx(SGFParser *parser, const char *buf, size_t len)
 {
   SGFNode *root;
   int tmpi = 0;
 
-  if (strcmp(filename, "-") == 0)
-    sgffile = stdin;
-  else
-    sgffile = fopen(filename, "r");
-
-  if (!sgffile)
-    return NULL;
-
-
-  nexttoken();
-  switch (setjmp (parser_caller))
+  parser->buffer = buf;
+  parser->p = buf;
+  parser->end = buf + len;
+  parser->error = NULL;
+  parser->errpos = 0;
+  parser->root = NULL;
+  parser->stack = NULL;
+  parser->stack_size = 0;
+
+  nexttoken(parser);
+  switch (setjmp (parser->caller))
     {
     case 2:
-      sgfFreeNode(root);
+      sgfFreeNode(parser->root);
     case 1:
+      free(parser->stack);
       return NULL;
     }
-  gametree(&root, NULL, LAX_SGF);
-
-  if (sgffile != stdin)
-    fclose(sgffile);
-
-  if (sgferr) {
-    fprintf(stderr, "Parse error: %s at position %d\n", sgferr, sgferrpos);
-    sgfFreeNode(root);
-    return NULL;
-  }
+  gametree(parser, &parser->root, LAX_SGF);
+  root = parser->root;
+  free(parser->stack);
 
   /* perform some simple checks on the file */
   if (!sgfGetIntProperty(root, "GM", &tmpi)) {
@@ -1141,6 +1559,125 @@ readsgffile(const char *filename)
 }
 
 
+/*
+ * Read a SGF tree from the LEN bytes at BUF.
+ */
+
+SGFNode *
+readsgfbuffer(const char *buf, size_t len)
+{
+  SGFParser parser;
+  return readsgf_ctx(&parser, buf, len);
+}
+
+
+/*
+ * Read the whole file FD into a new buffer and store its length in
+ * LEN. This is used for the files which cannot be mapped, like pipes.
+ */
+
+static char *
+read_whole_file(int fd, size_t *len)
+{
+  size_t size = FILE_BUFFER_CHUNK;
+  char *buffer = xalloc(size);
+  ssize_t n;
+
+  *len = 0;
+  while ((n = read(fd, buffer + *len, size - *len)) != 0) {
+    if (n < 0) {
+      free(buffer);
+      return NULL;
+    }
+    *len += n;
+    if (*len == size) {
+      size += FILE_BUFFER_CHUNK;
+      buffer = xrealloc(buffer, size);
+    }
+  }
+  return buffer;
+}
+
+
+/*
+ * Give the input SOURCE of LEN bytes of the tree ROOT to the tree,
+ * which refers to it for its values, so that it is released with the
+ * tree. MAPPED tells whether it is mapped or allocated.
+ */
+
+static void
+tree_keep_source(SGFNode *root, void *source, size_t len, int mapped)
+{
+  root->arena->source = source;
+  root->arena->source_length = len;
+  root->arena->source_mapped = mapped;
+}
+
+
+/*
+ * Wrapper around readsgf_ctx which reads a file by name. Regular
+ * files are mapped in memory and parsed from the mapping; other files
+ * are read at once into a buffer. Either way the input is kept until
+ * the tree is freed.
+ * Returns NULL if file will not open, or some other parsing error.
+ * Filename "-" means read from stdin, and leave it open when done.
+ */
+
+SGFNode *
+readsgffile(const char *filename)
+{
+  SGFParser parser;
+  SGFNode *root;
+  char *buffer;
+  size_t len;
+  int fd;
+#ifdef HAVE_MMAP
+  struct stat st;
+#endif
+
+  if (strcmp(filename, "-") == 0)
+    fd = STDIN_FILENO;
+  else
+    fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+
+#ifdef HAVE_MMAP
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map;
+    len = st.st_size;
+    map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+      madvise(map, len, MADV_SEQUENTIAL);
+#endif
+      root = readsgf_ctx(&parser, map, len);
+      if (root)
+        tree_keep_source(root, map, len, 1);
+      else
+        munmap(map, len);
+      if (fd != STDIN_FILENO)
+        close(fd);
+      return root;
+    }
+  }
+#endif
+
+  buffer = read_whole_file(fd, &len);
+  if (fd != STDIN_FILENO)
+    close(fd);
+  if (!buffer)
+    return NULL;
+  root = readsgf_ctx(&parser, buffer, len);
+  if (root)
+    tree_keep_source(root, buffer, len, 0);
+  else
+    free(buffer);
+  return root;
+}
+
+
 
 /* ================================================================ */
 /*                          Write SGF tree                          */
@@ -1149,42 +1686,71 @@ readsgffile(const char *filename)
 
 #define OPTION_STRICT_FF4 0
 
-static int sgf_column = 0;
+void
+sgfWriterInit(SGFWriter *w)
+{
+  w->data = NULL;
+  w->length = 0;
+  w->size = 0;
+  w->column = 0;
+  w->nprinted = 0;
+}
+
+void
+sgfWriterFree(SGFWriter *w)
+{
+  free(w->data);
+  w->data = NULL;
+}
+
+/* Make room in the output of W for N more characters. */
+void
+sgfWriterReserve(SGFWriter *w, size_t n)
+{
+  if (w->length + n <= w->size)
+    return;
+  while (w->length + n > w->size)
+    w->size = w->size ? 2 * w->size : 4096;
+  w->data = xrealloc(w->data, w->size);
+}
 
 static void
-sgf_putc(int c, FILE *file)
+sgf_putc(SGFWriter *w, int c)
 {
-  if (c == '\n' && sgf_column == 0)
+  if (c == '\n' && w->column == 0)
     return;
 
-  fputc(c, file);
+  sgfWriterReserve(w, 2);
+  w->data[w->length++] = c;
 
   if (c == '\n')
-    sgf_column = 0;
+    w->column = 0;
   else
-    sgf_column++;
+    w->column++;
 
-  if (c == ']' && sgf_column > 60) {
-    fputc('\n', file);
-    sgf_column = 0;
+  if (c == ']' && w->column > 60) {
+    w->data[w->length++] = '\n';
+    w->column = 0;
   }
 }
 
 static void
-sgf_puts(const char *s, FILE *file)
+sgf_puts(SGFWriter *w, const char *s)
 {
+  size_t start = w->length;
+
+  /* Each character takes two bytes at most. */
+  sgfWriterReserve(w, 2 * strlen(s));
   for (; *s; s++) {
-    if (*s == '[' || *s == ']' || *s == '\\') {
-      fputc('\\', file);
-      sgf_column++;
-    }
-    fputc((int) *s, file);
-    sgf_column++;
+    if (*s == '[' || *s == ']' || *s == '\\')
+      w->data[w->length++] = '\\';
+    w->data[w->length++] = *s;
   }
+  w->column += w->length - start;
 }
 
-/* Print all properties with the given name in a node to file and mark
- * them as printed.
+/* Print all properties with the given name in a node and record them
+ * as printed.
  *
  * If is_comment is 1, multiple properties are concatenated with a
  * newline. I.e. we write
@@ -1200,71 +1766,83 @@ sgf_puts(const char *s, FILE *file)
  */
 
 static void
-sgf_print_name(FILE *file, short name)
+sgf_print_name(SGFWriter *w, short name)
 {
-  sgf_putc(name & 0xff, file);
+  sgf_putc(w, name & 0xff);
   if (name >> 8 != ' ')
-    sgf_putc(name >> 8, file);
+    sgf_putc(w, name >> 8);
 }
 
 static void
-sgf_print_property(FILE *file, SGFNode *node, short name, int is_comment)
+sgf_print_property(SGFWriter *w, SGFNode *node, short name, int is_comment)
 {
   int n = 0;
   SGFProperty *prop;
 
-  for (prop = node->props; prop; prop = prop->next) {
+  if (w->nprinted < (int) (sizeof(w->printed) / sizeof(w->printed[0])))
+    w->printed[w->nprinted++] = name;
+
+  for (prop = find_property(node, name); prop; prop = prop->next) {
     if (prop->name == name) {
-      prop->name |= 0x20;  /* Indicate already printed. */
       if (n == 0) {
-	sgf_print_name(file, name);
-	sgf_putc('[', file);
+	sgf_print_name(w, name);
+	sgf_putc(w, '[');
       }
       else if (is_comment)
-	sgf_putc('\n', file);
+	sgf_putc(w, '\n');
       else {
-	sgf_putc(']', file);
-	sgf_putc('[', file);
+	sgf_putc(w, ']');
+	sgf_putc(w, '[');
       }
 
-      sgf_puts(prop->value, file);
+      sgf_puts(w, property_value(node, prop));
       n++;
     }
   }
 
   if (n > 0)
-    sgf_putc(']', file);
+    sgf_putc(w, ']');
 
   /* Add a newline after certain properties. */
   if (name == SGFAB || name == SGFAW || name == SGFAE || (is_comment && n > 1))
-    sgf_putc('\n', file);
+    sgf_putc(w, '\n');
 }
 
 /*
- * Print all remaining unprinted property values at node N to file.
+ * Print all remaining unprinted property values at node N. A name is
+ * printed at its first property, unless it has been printed already.
  */
 
 static void
-sgfPrintRemainingProperties(FILE *file, SGFNode *node)
+sgfPrintRemainingProperties(SGFWriter *w, SGFNode *node)
 {
   SGFProperty *prop;
 
-  for (prop = node->props; prop; prop = prop->next)
-    if (!(prop->name & 0x20))
-      sgf_print_property(file, node, prop->name, 0);
+  for (prop = node->props; prop; prop = prop->next) {
+    int k;
+
+    if (find_property(node, prop->name) != prop)
+      continue;
+    for (k = 0; k < w->nprinted; k++)
+      if (w->printed[k] == prop->name)
+	break;
+    if (k == w->nprinted)
+      sgf_print_property(w, node, prop->name, 0);
+  }
 }
 
 
 /*
- * Print the property values of NAME at node N and mark it as printed.
+ * Print the property values of NAME at node N and record it as
+ * printed.
  */
 
 static void
-sgfPrintCharProperty(FILE *file, SGFNode *node, const char *name)
+sgfPrintCharProperty(SGFWriter *w, SGFNode *node, const char *name)
 {
   short nam = name[0] | name[1] << 8;
 
-  sgf_print_property(file, node, nam, 0);
+  sgf_print_property(w, node, nam, 0);
 }
 
 
@@ -1276,157 +1854,205 @@ sgfPrintCharProperty(FILE *file, SGFNode *node, const char *name)
  */
 
 static void
-sgfPrintCommentProperty(FILE *file, SGFNode *node, const char *name)
+sgfPrintCommentProperty(SGFWriter *w, SGFNode *node, const char *name)
 {
   short nam = name[0] | name[1] << 8;
 
-  sgf_print_property(file, node, nam, 1);
+  sgf_print_property(w, node, nam, 1);
 }
 
 
 static void
-unparse_node(FILE *file, SGFNode *node)
+unparse_node(SGFWriter *w, SGFNode *node)
 {
-  sgf_putc(';', file);
-  sgfPrintCharProperty(file, node, "B ");
-  sgfPrintCharProperty(file, node, "W ");
-  sgfPrintCommentProperty(file, node, "N ");
-  sgfPrintCommentProperty(file, node, "C ");
-  sgfPrintRemainingProperties(file, node);
+  w->nprinted = 0;
+  sgf_putc(w, ';');
+  sgfPrintCharProperty(w, node, "B ");
+  sgfPrintCharProperty(w, node, "W ");
+  sgfPrintCommentProperty(w, node, "N ");
+  sgfPrintCommentProperty(w, node, "C ");
+  sgfPrintRemainingProperties(w, node);
 }
 
 
 static void
-unparse_root(FILE *file, SGFNode *node)
+unparse_root(SGFWriter *w, SGFNode *node)
 {
-  sgf_putc(';', file);
+  w->nprinted = 0;
+  sgf_putc(w, ';');
 
   if (sgfHasProperty(node, "GM"))
-    sgfPrintCharProperty(file, node, "GM");
+    sgfPrintCharProperty(w, node, "GM");
   else {
-    fputs("GM[1]", file);
-    sgf_column += 5;
+    sgfWriterReserve(w, 5);
+    memcpy(w->data + w->length, "GM[1]", 5);
+    w->length += 5;
+    w->column += 5;
   }
 
-  sgfPrintCharProperty(file, node, "FF");
-  sgf_putc('\n', file);
+  sgfPrintCharProperty(w, node, "FF");
+  sgf_putc(w, '\n');
 
-  sgfPrintCharProperty(file, node, "SZ");
-  sgf_putc('\n', file);
+  sgfPrintCharProperty(w, node, "SZ");
+  sgf_putc(w, '\n');
 
-  sgfPrintCharProperty(file, node, "GN");
-  sgf_putc('\n', file);
+  sgfPrintCharProperty(w, node, "GN");
+  sgf_putc(w, '\n');
 
-  sgfPrintCharProperty(file, node, "DT");
-  sgf_putc('\n', file);
+  sgfPrintCharProperty(w, node, "DT");
+  sgf_putc(w, '\n');
 
-  sgfPrintCommentProperty(file, node, "PB");
-  sgfPrintCommentProperty(file, node, "BR");
-  sgf_putc('\n', file);
+  sgfPrintCommentProperty(w, node, "PB");
+  sgfPrintCommentProperty(w, node, "BR");
+  sgf_putc(w, '\n');
 
-  sgfPrintCommentProperty(file, node, "PW");
-  sgfPrintCommentProperty(file, node, "WR");
-  sgf_putc('\n', file);
+  sgfPrintCommentProperty(w, node, "PW");
+  sgfPrintCommentProperty(w, node, "WR");
+  sgf_putc(w, '\n');
 
-  sgfPrintCommentProperty(file, node, "N ");
-  sgfPrintCommentProperty(file, node, "C ");
-  sgfPrintRemainingProperties(file, node);
+  sgfPrintCommentProperty(w, node, "N ");
+  sgfPrintCommentProperty(w, node, "C ");
+  sgfPrintRemainingProperties(w, node);
 
-  sgf_putc('\n', file);
+  sgf_putc(w, '\n');
 }
 
 
 /*
+ * Print the game tree whose root is NODE. Each game tree is its first
+ * node and the main line under it, followed by the game trees of the
+ * variations of its last node. Like the parser, this keeps the heads
+ * of the enclosing game trees in a stack of its own instead of
+ * recursing.
+ *
  * p->child is the next move.
  * p->next  is the next variation
  */
 
 static void
-unparse_game(FILE *file, SGFNode *node, int root)
+unparse_game(SGFWriter *w, SGFNode *node)
 {
-  if (!root)
-    sgf_putc('\n', file);
-  sgf_putc('(', file);
-  if (root)
-    unparse_root(file, node);
-  else
-    unparse_node(file, node);
+  SGFNode **stack = NULL;
+  size_t stack_size = 0;
+  size_t depth = 0;
+
+  sgf_putc(w, '(');
+  unparse_root(w, node);
 
-  node = node->child;
-  while (node != NULL && node->next == NULL) {
-    unparse_node(file, node);
+  for (;;) {
     node = node->child;
-  }
+    while (node != NULL && node->next == NULL) {
+      unparse_node(w, node);
+      node = node->child;
+    }
 
-  while (node != NULL) {
-    unparse_game(file, node, 0);
-    node = node->next;
+    /* Close the game trees with no more variations. */
+    while (node == NULL) {
+      sgf_putc(w, ')');
+      if (depth == 0) {
+	sgf_putc(w, '\n');
+	free(stack);
+	return;
+      }
+      node = stack[--depth]->next;
+    }
+
+    if (depth == stack_size) {
+      stack_size = stack_size ? 2 * stack_size : 64;
+      stack = xrealloc(stack, stack_size * sizeof(SGFNode *));
+    }
+    stack[depth++] = node;
+
+    sgf_putc(w, '\n');
+    sgf_putc(w, '(');
+    unparse_node(w, node);
   }
-  sgf_putc(')', file);
-  if (root)
-    sgf_putc('\n', file);
 }
 
-/* Printed properties are marked by adding the 0x20 bit to the
- * property name (changing an upper case letter to lower case). This
- * function removes this mark so that we can print the property next
- * time too. It recurses to all properties in the linked list.
+
+/*
+ * Write the LEN bytes at DATA to FILENAME. They go to a new file next
+ * to it first, which is flushed to disk and then renamed over
+ * FILENAME, so that a crash leaves either the old or the new contents.
+ * The new file keeps the permissions of the old one. If FILENAME is a
+ * symbolic link, the link itself is replaced by a regular file.
  */
-static void
-restore_property(SGFProperty *prop)
+
+int
+sgfWriteFileAtomically(const char *filename, const char *data, size_t len)
 {
-  if (prop) {
-    restore_property(prop->next);
-    prop->name &= ~0x20;
+  size_t size = strlen(filename) + 16;
+  char *tmpname = xalloc(size);
+  unsigned int seed = (unsigned int) getpid() ^ (unsigned int) time(NULL);
+  struct stat st;
+  int fd = -1;
+  int failed;
+  int k;
+
+  for (k = 0; k < 100 && fd < 0; k++) {
+    seed = seed * 1103515245 + 12345;
+    snprintf(tmpname, size, "%s.%06x", filename, (seed >> 8) & 0xffffff);
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 && errno != EEXIST)
+      break;
+  }
+  if (fd < 0) {
+    free(tmpname);
+    return 0;
   }
-}
 
-/* When called with the tree root, recurses to all properties in the
- * tree and removes all print marks.
- */
-static void
-restore_node(SGFNode *node)
-{
-  if (node) {
-    restore_property(node->props);
-    restore_node(node->child);
-    restore_node(node->next);
+  if (stat(filename, &st) == 0)
+    fchmod(fd, st.st_mode & 07777);
+
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      break;
+    }
+    data += n;
+    len -= n;
+  }
+
+  failed = len > 0 || fsync(fd) != 0;
+  if (close(fd) != 0 || failed || rename(tmpname, filename) != 0) {
+    unlink(tmpname);
+    free(tmpname);
+    return 0;
   }
+
+  free(tmpname);
+  return 1;
 }
 
 
 /*
  * Opens filename and writes the game stored in the sgf structure.
+ * The game is formatted in memory and written at once; a file other
+ * than "-" (stdout) is replaced atomically.
  */
 
 int
 writesgf(SGFNode *root, const char *filename)
 {
-  FILE *outfile;
-
-  if (strcmp(filename, "-") == 0)
-    outfile = stdout;
-  else
-    outfile = fopen(filename, "w");
-
-  if (!outfile) {
-    fprintf(stderr, "Can not open %s\n", filename);
-    return 0;
-  }
+  SGFWriter w;
+  int ok;
 
   sgf_write_header_reduced(root, 0);
 
-  sgf_column = 0;
-  unparse_game(outfile, root, 1);
-  if (outfile != stdout)
-    fclose(outfile);
+  sgfWriterInit(&w);
+  unparse_game(&w, root);
 
-  /* Remove "printed" marks so that the tree can be written multiple
-   * times.
-   */
-  restore_node(root);
+  if (strcmp(filename, "-") == 0)
+    ok = fwrite(w.data, 1, w.length, stdout) == w.length;
+  else
+    ok = sgfWriteFileAtomically(filename, w.data, w.length);
+  sgfWriterFree(&w);
 
-  return 1;
+  if (!ok)
+    fprintf(stderr, "Can not write %s\n", filename);
+  return ok;
 }
 
 
@@ -1435,22 +2061,17 @@ int
 main()
 {
   static char buffer[25000];
-  static char output[25000];
   SGFNode *game;
+  SGFParser parser;
 
-  sgffile = stdin;
-
-  nexttoken();
-  gametree(&game, LAX_SGF);
-  if (sgferr) {
+  game = readsgf_ctx(&parser, buffer, fread(buffer, 1, sizeof(buffer), stdin));
+  if (!game) {
     fprintf(stderr, "Parse error:");
-    fprintf(stderr, sgferr, sgferrarg);
-    fprintf(stderr, " at position %d\n", sgferrpos);
-  }
-  else {
-    unparse_game(stdin, game, 1);
-    write(1, output, outputp - output);
+    fprintf(stderr, "%s", parser.error);
+    fprintf(stderr, " at position %d\n", parser.errpos);
   }
+  else
+    writesgf(game, "-");
 }
 #endif
 
@@ -24,6 +24,7 @@
 #define _SGFTREE_H_
 
 #include <stdio.h>
+#include <setjmp.h>
 
 #include "sgf_properties.h"
 
@@ -49,26 +50,57 @@ void *xalloc(unsigned int);
 /*
  * A property of an SGF node.  An SGF node is described by a linked
  * list of these.
+ *
+ * The value of a property read from a file is the slice of the input
+ * between the brackets, as RAW and LENGTH, with the escapes still to
+ * be processed if ESCAPED is set. VALUE, the value as a string, is
+ * only made when sgfGetCharProperty asks for it. Use
+ * sgfGetCharProperty or sgfPropertyText rather than the fields.
  */
 
 typedef struct SGFProperty_t {
   struct SGFProperty_t *next;
   short name;
+  unsigned char escaped;
+  unsigned int length;
+  const char *raw;
   char *value;
 } SGFProperty;
 
 
+/* The memory of the nodes and properties of a tree, released at once
+ * when the root is freed. Private to sgfnode.c.
+ */
+typedef struct SGFArena_t SGFArena;
+
+/* The properties of a node sorted by name, to look them up. Private
+ * to sgfnode.c.
+ */
+typedef struct SGFIndex_t SGFIndex;
+
 typedef struct SGFNode_t {
   SGFProperty *props;
   struct SGFNode_t *parent;
   struct SGFNode_t *child;
   struct SGFNode_t *next;
+  SGFArena *arena;
+  SGFIndex *index;              /* NULL until needed */
+  unsigned int mask;            /* A bit for the name of each property */
+  unsigned int nprops;          /* Length of PROPS */
 } SGFNode;
 
 
 /* low level functions */
+/*
+ * The getters below are not read only: the first lookups of a node
+ * build its index and the first sgfGetCharProperty of a property
+ * stores its value, both in the memory of the tree. A tree must
+ * therefore not be shared between threads, even to read it.
+ */
 SGFNode *sgfPrev(SGFNode *node);
 SGFNode *sgfRoot(SGFNode *node);
+/* sgfNewNode makes the root of a new tree. The nodes added to it share
+ * its memory, which sgfFreeNode releases when given the root. */
 SGFNode *sgfNewNode(void);
 void sgfFreeNode(SGFNode *node);
 
@@ -85,6 +117,10 @@ void *xrealloc(void *pt, unsigned int size);
 SGFProperty *sgfMkProperty(const char *name, const  char *value,
 			   SGFNode *node, SGFProperty *last);
 void sgfFreeProperty(SGFProperty *prop);
+/* Store the value of PROP as a string in BUF, truncated to SIZE-1
+ * characters, and return its full length. Nothing is stored if SIZE
+ * is 0, so BUF may be NULL to get the length only. */
+size_t sgfPropertyText(SGFProperty *prop, char *buf, size_t size);
 
 SGFNode *sgfAddStone(SGFNode *node, int color, int movex, int movey);
 SGFNode *sgfAddPlay(SGFNode *node, int who, int movex, int movey);
@@ -110,14 +146,58 @@ SGFNode *sgfAddChild(SGFNode *node);
 
 SGFNode *sgfCreateHeaderNode(int boardsize, float komi, int handicap);
 
+/* The state of a parse. Its fields are private to the parser. */
+typedef struct SGFParser_t {
+  const char *buffer;          /* The input */
+  const char *p;               /* Next character of the input */
+  const char *end;             /* End of the input */
+  int lookahead;               /* Next token */
+  const char *error;           /* Message of the last error, or NULL */
+  int errpos;                  /* Position of the last error */
+  SGFNode *root;
+  SGFNode **stack;             /* Heads of the enclosing game trees */
+  size_t stack_size;
+  jmp_buf caller;
+} SGFParser;
+
 /* Read SGF tree from file. */
 SGFNode *readsgffile(const char *filename);
+/* Read SGF tree from a buffer in memory. The values of the tree are
+   kept in the buffer, so it must not be freed before the tree. */
+SGFNode *readsgfbuffer(const char *buf, size_t len);
+/* Read SGF tree from a buffer, with its own parser state, so several
+   trees can be read at once in different threads. The buffer must
+   outlive the tree too. */
+SGFNode *readsgf_ctx(SGFParser *parser, const char *buf, size_t len);
 /* Specific solution for fuseki */
 SGFNode *readsgffilefuseki(const char *filename, int moves_per_game);
 
 /* Write SGF tree to a file. */
 int writesgf(SGFNode *root, const char *filename);
 
+/* The output of a writer, formatted in memory and written to the file
+ * at once. DATA holds LENGTH characters and room for SIZE. The other
+ * fields are private to writesgf: PRINTED holds the names of the
+ * properties of the current node already printed.
+ */
+typedef struct SGFWriter_t {
+  char *data;
+  size_t length;
+  size_t size;
+  int column;
+  short printed[16];
+  int nprinted;
+} SGFWriter;
+
+void sgfWriterInit(SGFWriter *w);
+void sgfWriterFree(SGFWriter *w);
+/* Make room in DATA for N more characters, which the caller may then
+ * store after the LENGTH first ones. */
+void sgfWriterReserve(SGFWriter *w, size_t n);
+/* Replace FILENAME by the LEN bytes at DATA, so that it is never left
+ * half written. Return 0 on failure. */
+int sgfWriteFileAtomically(const char *filename, const char *data, size_t len);
+
 
 /* ---------------------------------------------------------------- */
 /* ---                          SGFTree                         --- */
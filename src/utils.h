@@ -25,15 +25,7 @@
 #include <locale.h>
 #include <libintl.h>
 
-#ifndef TRUE
-# define TRUE 1
-#endif
-
-#ifndef FALSE
-# define FALSE 0
-#endif
-
-typedef int boolean;
+#include "conn-types.h"
 
 /* I18N */
 #define _(str)  gettext(str)